@@ -2,18 +2,108 @@
 #include <FL/Fl_Window.h>
 #include <FL/Fl_Gl_Window.h>
 #include <FL/gl.h>
-#include <MersenneTwister.h>
 #include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <math.h>
 #include <string.h>
-#include "texture.c"
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#endif
 
 #define WIDTH 640
 #define HEIGHT 480
 #define PI 3.1415926535
 
+//simd kernels are compiled with per-function target attributes and picked at runtime, so the binary still runs on cpus without them
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SIMD_KERNELS 1
+#else
+#define SIMD_KERNELS 0
+#endif
+//mingw gcc doesn't keep the stack 32 byte aligned for spilled avx registers (gcc bug 54412), so the 8-wide kernels are left out there
+#if SIMD_KERNELS && !(defined(WIN32) && !defined(__clang__))
+#define SIMD_AVX2_KERNELS 1
+#else
+#define SIMD_AVX2_KERNELS 0
+#endif
+
+//if WELD_SCENE_GEOMETRY is enabled, duplicate vertices of the generated objects are merged into indexed meshes once the scene is built
+#define WELD_SCENE_GEOMETRY 1
+//if COMPACT_SCENE_GEOMETRY is enabled, the generated objects are re-encoded with rgba8 colors and 16 bit texcoords once the scene is built,
+//QUANTIZE_SCENE_POSITIONS additionally stores positions as 16 bit values relative to each object's bounding box
+#define COMPACT_SCENE_GEOMETRY 1
+#define QUANTIZE_SCENE_POSITIONS 1
+
+//if DOTTED_SPIRAL_AS_POINTS is enabled, dotted spirals are point clouds drawn as screen aligned discs (one vertex per dot)
+//instead of a small sphere mesh per dot
+#define DOTTED_SPIRAL_AS_POINTS 1
+
+//if THIN_SPIRALS_AS_LINES is enabled, spirals are a single line strip through the helix instead of a triangular tube per segment
+#define THIN_SPIRALS_AS_LINES 1
+
+//if PARALLEL_GENERATION is enabled, generators and scene preparation split their work across a thread pool with one thread per core
+#define PARALLEL_GENERATION 1
+
+//if CACHE_GENERATED_MESHES is enabled, single colored tubes and sphereoids are kept by the generators that build them, keyed by
+//the parameters, and copied when the same mesh is asked for again. tube and dotted spirals are swept from one of those per side
+//or dot, so this only matters when THIN_SPIRALS_AS_LINES or DOTTED_SPIRAL_AS_POINTS is off
+#define CACHE_GENERATED_MESHES 1
+
+//if EMBED_GIMP_TEXTURE is enabled, texture.c is compiled in and is what whichtexture 2 shows unless --texture is given,
+//otherwise whichtexture 2 loads TEXTURE_FILE (or the --texture file) when the program starts
+#define EMBED_GIMP_TEXTURE 0
+#define TEXTURE_FILE "texture.bmp"
+#if EMBED_GIMP_TEXTURE
+#include "texture.c"
+#endif
+
+//if TEXTURE_MIPMAPS is enabled, textures keep a box filtered mip chain next to their texels, updated where they're drawn to,
+//and are sampled with GL_LINEAR_MIPMAP_LINEAR so far away stripes don't alias
+#define TEXTURE_MIPMAPS 1
+
+//if TEXTURE_ATLAS is enabled, the uvmaps of all textured objects are packed into shared ATLAS_PAGE_SIZE square textures
+//and drawn from there, so a scene of textured objects binds one texture instead of one per object
+#define TEXTURE_ATLAS 1
+#define ATLAS_PAGE_SIZE 512
+
+//if CACHE_SCENE_ON_DISK is enabled, runs given --seed keep the spirals, sphere, barberpole and its uvmap in SCENE_CACHE_FILE,
+//and later runs with the same seed and parameters map that file and copy them out instead of generating them
+#define CACHE_SCENE_ON_DISK 1
+
+//if PRINT_ALLOCATION_STATS is enabled, how much scene construction took from the scene arena (and from the heap) is displayed
+#define PRINT_ALLOCATION_STATS 0
+
+//if PRINT_MESH_CACHE_STATS is enabled, how many generated meshes were found in the cache (and how many had to be built) is displayed
+//once the scene is built
+#define PRINT_MESH_CACHE_STATS 0
+
+//if PRINT_CULLING_STATS is enabled, every draw prints how many objects were drawn and how many were skipped by frustum culling
+#define PRINT_CULLING_STATS 0
+
+//if PRINT_PICKED_OBJECTS is enabled, clicking an object prints its index in the scene
+#define PRINT_PICKED_OBJECTS 0
+
 //if GENERATE_TIKZ_OUTPUT is enabled, LaTeX+TIKZ commands to draw the uvmaps will be displayed to stdout, (intended to be used with output redirection)
 #define GENERATE_TIKZ_OUTPUT 0
 
@@ -161,10 +251,108 @@ template<class T> tuple4<T> make_tuple4(T a,T b,T c,T d)
 
 #define absolute(x) (((x)<0)?(-(x)):(x))
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+//counter based random numbers: the nth number of a stream is a hash of the stream's key and n, so selecting a stream is
+//two assignments (instead of seeding a whole mersenne twister), and work split across threads can give each item its own
+//stream, which keeps a seeded scene identical however the work got scheduled
+uint64_t random_seed = 0;
+
+uint64_t random_mix(uint64_t z)
+{
+  //splitmix64's finalizer
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//plain data so it can be thread local, see thread_random
+struct random_stream
+{
+  void select(uint64_t stream)
+  {
+    key = random_mix(random_seed ^ random_mix(stream+1));
+    counter = 0;
+    selected = true;
+  }
+  uint64_t next_u64()
+  {
+    return random_mix(key + (counter++)*0x9e3779b97f4a7c15ULL);
+  }
+  //[0,1)
+  double next_double()
+  {
+    return (next_u64() >> 11)*(1.0/9007199254740992.0);
+  }
+  float uniform(float min, float max)
+  {
+    return float(min + (max-min)*next_double());
+  }
+  //[0,n], like MTRand::randInt
+  unsigned long next_int(unsigned long n)
+  {
+    return (unsigned long)(next_u64() % (uint64_t(n)+1));
+  }
+  void fill_uniform(float* out, size_t count, float min, float max)
+  {
+    for(size_t c1=0;c1<count;c1++)
+    {
+      out[c1] = uniform(min,max);
+    }
+  }
+  uint64_t key;
+  uint64_t counter;
+  bool selected;
+};
+
+THREAD_LOCAL random_stream thread_stream;
+
+//the calling thread's current stream. threads that never selected one get a stream of their own, which is fine for
+//anything that doesn't need to be reproducible
+random_stream& thread_random()
+{
+  if(!thread_stream.selected)thread_stream.select(uint64_t(size_t(&thread_stream)));
+  return thread_stream;
+}
+
+//makes the calling thread continue from the start of the given stream
+void select_random_stream(uint64_t stream)
+{
+  thread_stream.select(stream);
+}
+
+//parallel tasks select a stream per item, this puts back whatever the thread was on before (the thread calling
+//parallel_for runs chunks too, and its own sequence shouldn't depend on how many it got)
+class random_stream_scope
+{
+  public:
+  random_stream_scope()
+  {
+    saved = thread_stream;
+  }
+  ~random_stream_scope()
+  {
+    thread_stream = saved;
+  }
+  
+  private:
+  random_stream saved;
+};
+
+//call before generating anything, the calling thread starts on stream 0
+void seed_random(uint64_t seed)
+{
+  random_seed = seed;
+  select_random_stream(0);
+}
+
 float rand_float(float min,float max)
 {
-   MTRand mtrandom;
-   return float(mtrandom.rand(max-min)+min);
+  return thread_random().uniform(min,max);
 }
 
 struct vertex_type
@@ -190,6 +378,7 @@ triangle_type triangle_from_points(tuple3<float> a, tuple3<float> b, tuple3<floa
   for(int c1=0;c1<3;c1++)
   {
     retval.verts[c1].color = color;
+    retval.verts[c1].texcoords = make_tuple2<float>(0,0); //unused, but welding and compaction look at every field
   }
   retval.verts[0].pos = a;
   retval.verts[1].pos = b;
@@ -216,277 +405,3485 @@ triangle_type triangle_from_points(tuple3<float> a, tuple3<float> b, tuple3<floa
   return retval;
 }
 
-std::vector<triangle_type> triangles_from_rectangle(tuple3<float> a, tuple3<float> b, tuple3<float> c, tuple3<float> d, tuple4<float> color)
-{
-  std::vector<triangle_type> retval;
-  retval.push_back(triangle_from_points(a,b,c,color));
-  retval.push_back(triangle_from_points(b,c,d,color));
-  return retval;
-}
-
-std::vector<triangle_type> triangles_from_rectangle(tuple3<float> a, tuple3<float> b, tuple3<float> c, tuple3<float> d, float u1, float v1, float u2, float v2, tuple4<float> color)
+//the rectangles write their two triangles through an output iterator (a pointer into a presized buffer, or a
+//std::back_inserter on a reserved vector) and return it advanced, so generating geometry allocates nothing per face
+template<class OutputIt>
+OutputIt triangles_from_rectangle(tuple3<float> a, tuple3<float> b, tuple3<float> c, tuple3<float> d, tuple4<float> color, OutputIt out)
 {
-  std::vector<triangle_type> retval;
-  retval.push_back(triangle_from_points(a,b,c,make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v1),make_tuple2(u1,v2)),color));
-  retval.push_back(triangle_from_points(b,c,d,make_tuple3(make_tuple2(u2,v1),make_tuple2(u1,v2),make_tuple2(u2,v2)),color));
-  return retval;
+  *out++ = triangle_from_points(a,b,c,color);
+  *out++ = triangle_from_points(b,c,d,color);
+  return out;
 }
 
-#define rotate_in_plane(plane1,plane2,the_point,rot_amount)\
-float plane1 ## plane2 ## _magnitude = sqrt(the_point.plane1 * the_point.plane1 + the_point.plane2 * the_point.plane2);\
-float plane1 ## plane2 ## _angle = atan2(the_point.plane2,the_point.plane1);\
-tuple3<float> plane1 ## plane2 ## _point = the_point;\
-plane1 ## plane2 ## _point.plane1 = plane1 ## plane2 ## _magnitude * cos(plane1 ## plane2 ## _angle + rot_amount);\
-plane1 ## plane2 ## _point.plane2 = plane1 ## plane2 ## _magnitude * sin(plane1 ## plane2 ## _angle + rot_amount);
-
-tuple3<float> rotate_point(const tuple3<float>& point, const tuple3<float>& rotation)
+template<class OutputIt>
+OutputIt triangles_from_rectangle(tuple3<float> a, tuple3<float> b, tuple3<float> c, tuple3<float> d, float u1, float v1, float u2, float v2, tuple4<float> color, OutputIt out)
 {
-  tuple3<float> retval;
-  rotate_in_plane(x,y,point,rotation.y)
-  rotate_in_plane(x,z,xy_point,rotation.x)
-  rotate_in_plane(y,z,xz_point,rotation.z)
-  retval = yz_point;
-  return retval;
+  *out++ = triangle_from_points(a,b,c,make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v1),make_tuple2(u1,v2)),color);
+  *out++ = triangle_from_points(b,c,d,make_tuple3(make_tuple2(u2,v1),make_tuple2(u1,v2),make_tuple2(u2,v2)),color);
+  return out;
 }
 
-//obsolete version left in to illustrate the concept behind the possibly more obscure generalized version above
-/*tuple3<float> rotate_point(const tuple3<float>& point, float theta_rot, float phi_rot)
-{
-  float magnitude = sqrt(point.x*point.x + point.y*point.y + point.z*point.z);
-  float xz_magnitude = sqrt(point.x*point.x + point.z*point.z);
-  float theta = atan2(point.z,point.x); //radians in a circle aligned with xz plane
-  float phi = atan2(point.y,xz_magnitude); //radians above the xz plane
-  tuple3<float> retval;
-  retval.x = xz_magnitude*cos(theta+theta_rot);
-  retval.z = xz_magnitude*sin(theta+theta_rot);
-  retval.y = magnitude*sin(phi+phi_rot);
-  //printf("in (%f,%f,%f) , out (%f,%f,%f)\n",point.x,point.y,point.z,retval.x,retval.y,retval.z);
-  return retval;
-}*/
-
-class texture_image
+//just enough of win32/pthreads for the thread pool and the arenas
+class mutex_type
 {
   public:
-  texture_image()
+#ifdef WIN32
+  mutex_type()
   {
-    glGenTextures(1,&texture_id);
-    data = NULL;
-    change_size(128,128);
+    InitializeCriticalSection(&handle);
   }
-  texture_image(const texture_image& other)
+  ~mutex_type()
   {
-    glGenTextures(1,&texture_id);
-    data = NULL;
-    change_size(other.texture_width,other.texture_height);
-    memcpy(data,other.data,texture_width*texture_height*4);
+    DeleteCriticalSection(&handle);
   }
-  ~texture_image()
+  void lock()
   {
-    glDeleteTextures(1,&texture_id);
-    free(data);
+    EnterCriticalSection(&handle);
   }
-  void change_size(int new_width, int new_height)
+  void unlock()
   {
-    if(data)free(data);
-    data = (unsigned char*)malloc(sizeof(unsigned char)*new_width*new_height*4);
-    texture_width = new_width;
-    texture_height = new_height;
+    LeaveCriticalSection(&handle);
   }
-  void putpixel(int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+  
+  private:
+  CRITICAL_SECTION handle;
+#else
+  mutex_type()
   {
-    
-    data[4*(y*texture_width+x)] = r;
-    data[4*(y*texture_width+x)+1] = g;
-    data[4*(y*texture_width+x)+2] = b;
-    data[4*(y*texture_width+x)+3] = a;
+    pthread_mutex_init(&handle,NULL);
   }
-  tuple4<unsigned char> getpixel(int x, int y, unsigned char* raw_data = NULL)
+  ~mutex_type()
   {
-    if(raw_data == NULL)raw_data = this->data;
-    return make_tuple4<unsigned char>(raw_data[4*(y*texture_width+x)],raw_data[4*(y*texture_width+x)+1],raw_data[4*(y*texture_width+x)+2],raw_data[4*(y*texture_width+x)+3]);
+    pthread_mutex_destroy(&handle);
   }
-  void enforce_bounds(int& x, int& y)
+  void lock()
   {
-    if(x < 0)x = 0;
-    if(y < 0)y = 0;
-    if(x >= texture_width)x = texture_width-1;
-    if(y >= texture_height)y = texture_height-1;
+    pthread_mutex_lock(&handle);
   }
-  void drawline(int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+  void unlock()
   {
-    //Bresenham's line drawing algorithm, translated from the wikipedia pseudocode
-    int dx = absolute(x2-x1);
-    int dy = absolute(y2-y1);
-    int sx = (x1<x2)?1:-1;
-    int sy = (y1<y2)?1:-1;
-    int err = dx-dy;
-    
-    int x = x1;
-    int y = y1;
-    for(;;)
-    {
-      //x and y are clamped to valid ranges with the mod (%) operator to facilitate drawing specific slants of lines:
-      //drawline(0,0,2*width,height,...) can be used instead of drawline(0,0,width,height/2,...)
-      putpixel(x%texture_width,y%texture_height,r,g,b,a);
-      //there were some glitches where the algorithm missed the destination by 1 pixel for some lines (reason unknown)
-      //and continued to the edge, so the break condition next line differs from the wikipedia version
-      if((absolute(x-x2)<2) && (absolute(y-y2)<2))break;
-      if((err*2) > -dy)
-      {
-        err -= dy;
-        x += sx;
-      }
-      if((err*2) < dx)
-      {
-        err += dx;
-        y += sy;
-      }
-    }
-    //following code fragment was taken from debugging code in main, first line works without my
-    //modification, 2nd line misses by 1px and would corrupt memory if not for the mod-clamping
-    /*texture_image tex;
-    tex.drawline(32,32,54,54,64,64,64,255);
-    tex.drawline(54,54,44,61,64,64,64,255);*/
+    pthread_mutex_unlock(&handle);
   }
-  void apply_texture()
+  
+  private:
+  pthread_mutex_t handle;
+#endif
+  mutex_type(const mutex_type&);
+  mutex_type& operator=(const mutex_type&);
+};
+
+class scoped_lock
+{
+  public:
+  scoped_lock(mutex_type& m) : m(m)
   {
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D,texture_id);
-		glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_LINEAR); //GL_LINEAR or GL_NEAREST
-    glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
-		glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
-		glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
-		glTexParameterf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_REPLACE);
-		//glTexParameterf(GL_TEXTURE_ENV,GL_COMBINE_RGB,GL_REPLACE);
-		//glTexParameterf(GL_TEXTURE_ENV,GL_COMBINE_ALPHA,GL_REPLACE);
-    glTexImage2D(GL_TEXTURE_2D,0,4,texture_width,texture_height,0,GL_RGBA,GL_UNSIGNED_BYTE,data);
+    m.lock();
   }
-  void save_texture(const char* fname)
+  ~scoped_lock()
   {
-    FILE* f = fopen(fname,"wb");
-    if(f)
-    {
-      for(int c1=0;c1<texture_width*texture_height*4;c1+=4)
-      {
-        fprintf(f,"%c%c%c%c",data[c1],data[c1+1],data[c1+2],data[c1+3]);
-      }
-      fclose(f);
-    }
+    m.unlock();
   }
-  //the GNU Image Manipulation Program has the option to save images as raw data in a c source file, the following
-  //function uses those as textures, with the addition of "GIMP_IMAGE" to the struct type name in the generated file
-  void texture_from_gimp(const GIMP_IMAGE& image)
+  
+  private:
+  mutex_type& m;
+};
+
+class semaphore_type
+{
+  public:
+#ifdef WIN32
+  semaphore_type()
   {
-    change_size(image.width,image.height);
-    memcpy(data,image.pixel_data,image.width*image.height*4);
+    handle = CreateSemaphore(NULL,0,0x7fffffff,NULL);
   }
-  unsigned int texture_id;
-  unsigned char* data;
-  int texture_width;
-  int texture_height;
+  ~semaphore_type()
+  {
+    CloseHandle(handle);
+  }
+  void post(int count = 1)
+  {
+    ReleaseSemaphore(handle,count,NULL);
+  }
+  void wait()
+  {
+    WaitForSingleObject(handle,INFINITE);
+  }
+  
+  private:
+  HANDLE handle;
+#else
+  //unnamed posix semaphores aren't available everywhere (os x), so it's a counter under a condition variable
+  semaphore_type()
+  {
+    count = 0;
+    pthread_mutex_init(&lock,NULL);
+    pthread_cond_init(&condition,NULL);
+  }
+  ~semaphore_type()
+  {
+    pthread_cond_destroy(&condition);
+    pthread_mutex_destroy(&lock);
+  }
+  void post(int n = 1)
+  {
+    pthread_mutex_lock(&lock);
+    count += n;
+    pthread_cond_broadcast(&condition);
+    pthread_mutex_unlock(&lock);
+  }
+  void wait()
+  {
+    pthread_mutex_lock(&lock);
+    while(count == 0)pthread_cond_wait(&condition,&lock);
+    count--;
+    pthread_mutex_unlock(&lock);
+  }
+  
+  private:
+  int count;
+  pthread_mutex_t lock;
+  pthread_cond_t condition;
+#endif
 };
 
-class object3d
+int hardware_thread_count()
+{
+#ifdef WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int count = info.dwNumberOfProcessors;
+#else
+  int count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return (count > 0) ? count : 1;
+}
+
+//a range [begin,end) of a parallel_for, run on whichever thread gets to it
+class parallel_task
 {
   public:
-  object3d()
+  virtual ~parallel_task() {}
+  virtual void run(size_t begin, size_t end) = 0;
+};
+
+//work stealing pool: parallel_for cuts its range into chunks dealt out to per-thread queues, each thread works from the back
+//of its own queue and steals from the front of the others' when it runs dry. the calling thread takes part too.
+//tasks should only write to slots determined by their indices, so the output doesn't depend on who ran what
+class thread_pool
+{
+  public:
+  thread_pool(int thread_count)
   {
-    position = make_tuple3<float>(0,0,0);
-    rotation = make_tuple3<float>(0,0,0);
-    use_uvmap = false;
-    uvmap = NULL;
-    visible = true;
+    shutting_down = false;
+    busy = false;
+    remaining = 0;
+    for(int c1=0;c1<std::max(thread_count,1);c1++)
+    {
+      queues.push_back(new work_queue);
+    }
+    for(size_t c1=1;c1<queues.size();c1++)
+    {
+      worker_start* start = new worker_start;
+      start->pool = this;
+      start->index = c1;
+#ifdef WIN32
+      threads.push_back((HANDLE)_beginthreadex(NULL,0,worker_main,start,0,NULL));
+#else
+      pthread_t thread;
+      pthread_create(&thread,NULL,worker_main,start);
+      threads.push_back(thread);
+#endif
+    }
   }
-  ~object3d()
+  ~thread_pool()
   {
-    if(uvmap != NULL)delete uvmap;
+    shutting_down = true;
+    wake.post(threads.size());
+    for(size_t c1=0;c1<threads.size();c1++)
+    {
+#ifdef WIN32
+      WaitForSingleObject(threads[c1],INFINITE);
+      CloseHandle(threads[c1]);
+#else
+      pthread_join(threads[c1],NULL);
+#endif
+    }
+    for(size_t c1=0;c1<queues.size();c1++)
+    {
+      delete queues[c1];
+    }
   }
-  void initialize_uvmap()
+  int size() const
   {
-    if(uvmap != NULL)delete uvmap;
-    uvmap = new texture_image;
+    return queues.size();
   }
-  void draw_uvmap_outline()
+  //runs task over [0,count) in chunks of grain indices, and returns once all of them are done. small ranges, and calls made
+  //from inside a task, just run on the calling thread
+  void parallel_for(size_t count, size_t grain, parallel_task& task)
   {
-    if(uvmap == NULL)
+    grain = std::max(grain,size_t(1));
+    if(count == 0)return;
+    if(busy || threads.empty() || count <= grain)
     {
-      initialize_uvmap();
+      task.run(0,count);
+      return;
     }
-    MTRand mtrandom;
-    
-    for(int y=0;y<uvmap->texture_height;y++)
+    busy = true;
+    size_t chunk_count = (count+grain-1)/grain;
     {
-      for(int x=0;x<uvmap->texture_width;x++)
-      {
-        int lum = mtrandom.randInt(32)+32;
-        uvmap->putpixel(x,y,lum,lum,lum,255);
-      }
+      scoped_lock hold(remaining_lock);
+      remaining = chunk_count;
     }
-    if(GENERATE_TIKZ_OUTPUT)printf("\\begin{tikzpicture}\n");
-    for(int c1=0;c1<triangles.size();c1++)
+    for(size_t c1=0;c1<chunk_count;c1++)
     {
-      for(int c2=0;c2<3;c2++)
-      {
-        int x1 = triangles[c1].verts[c2].texcoords.x*uvmap->texture_width;
-        int y1 = triangles[c1].verts[c2].texcoords.y*uvmap->texture_height;
-        int x2 = triangles[c1].verts[(c2+1)%3].texcoords.x*uvmap->texture_width;
-        int y2 = triangles[c1].verts[(c2+1)%3].texcoords.y*uvmap->texture_height;
-        if(GENERATE_TIKZ_OUTPUT)printf("\\draw (%d,-%d) -- (%d,-%d);\n",x1,y1,x2,y2);
-        uvmap->drawline(x1,y1,x2,y2,mtrandom.randInt(127)+128,mtrandom.randInt(127)+128,mtrandom.randInt(127)+128,255);
-      }
+      chunk tmp;
+      tmp.begin = c1*grain;
+      tmp.end = std::min(count,tmp.begin+grain);
+      tmp.task = &task;
+      work_queue* queue = queues[c1%queues.size()];
+      scoped_lock hold(queue->lock);
+      queue->chunks.push_back(tmp);
     }
-    if(GENERATE_TIKZ_OUTPUT)printf("\\end{tikzpicture}\n");
+    wake.post(threads.size());
+    run_chunks(0);
+    done.wait();
+    busy = false;
   }
-  void draw_uvmap_barberpole()
+  
+  private:
+  struct chunk
   {
-    if(uvmap == NULL)
+    size_t begin;
+    size_t end;
+    parallel_task* task;
+  };
+  struct work_queue
+  {
+    mutex_type lock;
+    std::deque<chunk> chunks;
+  };
+  struct worker_start
+  {
+    thread_pool* pool;
+    int index;
+  };
+#ifdef WIN32
+  static unsigned __stdcall worker_main(void* arg)
+#else
+  static void* worker_main(void* arg)
+#endif
+  {
+    worker_start* start = (worker_start*)arg;
+    thread_pool* pool = start->pool;
+    int index = start->index;
+    delete start;
+    while(true)
     {
-      initialize_uvmap();
+      pool->wake.wait();
+      if(pool->shutting_down)break;
+      pool->run_chunks(index);
     }
-    MTRand mtrandom;
-    //draw the end caps with lines to provide fixed points to view rotation
-    draw_uvmap_outline();
-    //overwrite the sides
-    for(int y=uvmap->texture_height/2;y<uvmap->texture_height;y++)
+    return 0;
+  }
+  bool take_chunk(int self, chunk& out)
+  {
     {
-      for(int x=0;x<uvmap->texture_width;x++)
+      work_queue* own = queues[self];
+      scoped_lock hold(own->lock);
+      if(!own->chunks.empty())
       {
-        uvmap->putpixel(x,y,0,0,0,255);
+        out = own->chunks.back();
+        own->chunks.pop_back();
+        return true;
+      }
+    }
+    for(size_t c1=1;c1<queues.size();c1++)
+    {
+      work_queue* victim = queues[(self+c1)%queues.size()];
+      scoped_lock hold(victim->lock);
+      if(!victim->chunks.empty())
+      {
+        out = victim->chunks.front();
+        victim->chunks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+  void run_chunks(int self)
+  {
+    chunk tmp;
+    while(take_chunk(self,tmp))
+    {
+      tmp.task->run(tmp.begin,tmp.end);
+      scoped_lock hold(remaining_lock);
+      if(--remaining == 0)done.post();
+    }
+  }
+  std::vector<work_queue*> queues; //queues[0] belongs to the thread calling parallel_for
+#ifdef WIN32
+  std::vector<HANDLE> threads;
+#else
+  std::vector<pthread_t> threads;
+#endif
+  semaphore_type wake;
+  semaphore_type done;
+  mutex_type remaining_lock;
+  size_t remaining;
+  volatile bool shutting_down;
+  bool busy;
+};
+
+//created the first time it's needed, from the main thread
+thread_pool& worker_pool()
+{
+  static thread_pool pool(PARALLEL_GENERATION ? hardware_thread_count() : 1);
+  return pool;
+}
+
+template<class Task>
+void parallel_for(size_t count, size_t grain, Task& task)
+{
+  worker_pool().parallel_for(count,grain,task);
+}
+
+//monotonic arena: allocations are carved out of large blocks and only given back all at once, by reset() (which keeps the
+//blocks for reuse) or release(). scene construction and per-frame temporaries then cost a pointer bump instead of a malloc
+class memory_arena
+{
+  public:
+  memory_arena(size_t block_size = 1<<20)
+  {
+    this->block_size = block_size;
+    current_block = 0;
+    cursor = 0;
+    allocations = 0;
+    deallocations = 0;
+    bytes_allocated = 0;
+    bytes_reserved = 0;
+  }
+  ~memory_arena()
+  {
+    release();
+  }
+  //safe to call from pool threads, generators allocate up front so the lock is rarely contended
+  void* allocate(size_t size)
+  {
+    scoped_lock hold(lock);
+    size = (size+15) & ~size_t(15); //keeps every allocation 16 byte aligned, as malloc's are
+    while(current_block < blocks.size() && cursor+size > block_sizes[current_block])
+    {
+      current_block++;
+      cursor = 0;
+    }
+    if(current_block == blocks.size())
+    {
+      size_t new_size = std::max(block_size,size);
+      char* block = (char*)malloc(new_size);
+      if(block == NULL)throw std::bad_alloc();
+      blocks.push_back(block);
+      block_sizes.push_back(new_size);
+      bytes_reserved += new_size;
+      cursor = 0;
+    }
+    void* p = blocks[current_block]+cursor;
+    cursor += size;
+    allocations++;
+    bytes_allocated += size;
+    return p;
+  }
+  void note_deallocation()
+  {
+    scoped_lock hold(lock);
+    deallocations++;
+  }
+  //everything allocated so far is dead, start again from the first block
+  void reset()
+  {
+    current_block = 0;
+    cursor = 0;
+    allocations = 0;
+    deallocations = 0;
+    bytes_allocated = 0;
+  }
+  void release()
+  {
+    for(size_t c1=0;c1<blocks.size();c1++)
+    {
+      free(blocks[c1]);
+    }
+    blocks.clear();
+    block_sizes.clear();
+    bytes_reserved = 0;
+    reset();
+  }
+  //counters since the last reset, deallocations don't free anything and are only counted
+  size_t allocations;
+  size_t deallocations;
+  size_t bytes_allocated;
+  size_t bytes_reserved;
+  
+  private:
+  size_t block_size;
+  std::vector<char*> blocks;
+  std::vector<size_t> block_sizes;
+  size_t current_block;
+  size_t cursor;
+  mutex_type lock;
+};
+
+//while an arena_scope is alive, object3ds and triangle_lists are allocated from its arenas instead of the heap
+memory_arena* current_arena = NULL;
+memory_arena* current_geometry_arena = NULL; //for triangle_lists, which can go in an arena of their own
+size_t heap_allocations = 0; //what went to malloc instead, for comparison
+size_t heap_bytes = 0;
+mutex_type heap_stats_lock;
+
+class arena_scope
+{
+  public:
+  //geometry_arena, when given, takes the triangle_lists instead of arena. triangles that are only built to be welded or
+  //compacted can then be dropped all at once, while the objects made alongside them stay
+  arena_scope(memory_arena* arena, memory_arena* geometry_arena = NULL)
+  {
+    previous = current_arena;
+    previous_geometry = current_geometry_arena;
+    current_arena = arena;
+    current_geometry_arena = (geometry_arena != NULL) ? geometry_arena : arena;
+    closed = false;
+  }
+  ~arena_scope()
+  {
+    close();
+  }
+  //ends the scope early, for when it can't be a block of its own
+  void close()
+  {
+    if(!closed)
+    {
+      current_arena = previous;
+      current_geometry_arena = previous_geometry;
+    }
+    closed = true;
+  }
+  
+  private:
+  memory_arena* previous;
+  memory_arena* previous_geometry;
+  bool closed;
+};
+
+//each allocation is prefixed with the arena it came from (NULL for the heap), so it can be freed correctly
+//after the scope that made it has ended
+void* scene_allocate(size_t size, memory_arena* arena)
+{
+  const size_t header = 16;
+  char* p;
+  if(arena != NULL)
+  {
+    p = (char*)arena->allocate(size+header);
+  }
+  else
+  {
+    p = (char*)malloc(size+header);
+    if(p == NULL)throw std::bad_alloc();
+    scoped_lock hold(heap_stats_lock);
+    heap_allocations++;
+    heap_bytes += size+header;
+  }
+  *(memory_arena**)p = arena;
+  return p+header;
+}
+
+void scene_deallocate(void* ptr)
+{
+  if(ptr == NULL)return;
+  char* p = (char*)ptr-16;
+  memory_arena* arena = *(memory_arena**)p;
+  if(arena == NULL)free(p);
+  else arena->note_deallocation();
+}
+
+//stateless, so containers using it can still be swapped and copied freely whichever arena (if any) their memory is in
+template<class T>
+class arena_allocator
+{
+  public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  template<class U>
+  struct rebind
+  {
+    typedef arena_allocator<U> other;
+  };
+  arena_allocator() {}
+  template<class U>
+  arena_allocator(const arena_allocator<U>&) {}
+  pointer address(reference x) const
+  {
+    return &x;
+  }
+  const_pointer address(const_reference x) const
+  {
+    return &x;
+  }
+  pointer allocate(size_type n, const void* = 0)
+  {
+    return (pointer)scene_allocate(n*sizeof(T),current_geometry_arena);
+  }
+  void deallocate(pointer p, size_type)
+  {
+    scene_deallocate(p);
+  }
+  size_type max_size() const
+  {
+    return size_type(-1)/sizeof(T);
+  }
+  void construct(pointer p, const T& value)
+  {
+    new((void*)p) T(value);
+  }
+  void destroy(pointer p)
+  {
+    p->~T();
+  }
+};
+
+template<class T, class U>
+bool operator==(const arena_allocator<T>&, const arena_allocator<U>&)
+{
+  return true;
+}
+
+template<class T, class U>
+bool operator!=(const arena_allocator<T>&, const arena_allocator<U>&)
+{
+  return false;
+}
+
+typedef std::vector<triangle_type,arena_allocator<triangle_type> > triangle_list;
+
+//rotations are stored as three angles in radians, applied as: rotation.y in the x-y plane, then rotation.x in the x-z plane,
+//then rotation.z in the y-z plane (the order the original polar-coordinate rotate_point used, see below)
+class mat3
+{
+  public:
+  mat3()
+  {
+    
+  }
+  static mat3 identity()
+  {
+    mat3 tmp;
+    for(int row=0;row<3;row++)
+    {
+      for(int col=0;col<3;col++)
+      {
+        tmp.m[row][col] = (row == col) ? 1 : 0;
+      }
+    }
+    return tmp;
+  }
+  static mat3 from_rotation(const tuple3<float>& rotation)
+  {
+    float cos_xy = cos(rotation.y);
+    float sin_xy = sin(rotation.y);
+    float cos_xz = cos(rotation.x);
+    float sin_xz = sin(rotation.x);
+    float cos_yz = cos(rotation.z);
+    float sin_yz = sin(rotation.z);
+    //(y-z rotation)*(x-z rotation)*(x-y rotation), multiplied out
+    mat3 tmp;
+    tmp.m[0][0] = cos_xy*cos_xz;
+    tmp.m[0][1] = -sin_xy*cos_xz;
+    tmp.m[0][2] = -sin_xz;
+    tmp.m[1][0] = sin_xy*cos_yz - cos_xy*sin_xz*sin_yz;
+    tmp.m[1][1] = cos_xy*cos_yz + sin_xy*sin_xz*sin_yz;
+    tmp.m[1][2] = -cos_xz*sin_yz;
+    tmp.m[2][0] = sin_xy*sin_yz + cos_xy*sin_xz*cos_yz;
+    tmp.m[2][1] = cos_xy*sin_yz - sin_xy*sin_xz*cos_yz;
+    tmp.m[2][2] = cos_xz*cos_yz;
+    return tmp;
+  }
+  mat3 operator*(const mat3& other) const
+  {
+    mat3 tmp;
+    for(int row=0;row<3;row++)
+    {
+      for(int col=0;col<3;col++)
+      {
+        tmp.m[row][col] = m[row][0]*other.m[0][col] + m[row][1]*other.m[1][col] + m[row][2]*other.m[2][col];
+      }
+    }
+    return tmp;
+  }
+  tuple3<float> operator*(const tuple3<float>& p) const
+  {
+    return make_tuple3(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z,
+                       m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z,
+                       m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z);
+  }
+  mat3 transposed() const
+  {
+    mat3 tmp;
+    for(int row=0;row<3;row++)
+    {
+      for(int col=0;col<3;col++)
+      {
+        tmp.m[row][col] = m[col][row];
+      }
+    }
+    return tmp;
+  }
+  float m[3][3]; //row major
+};
+
+//stored column major, so data() can be handed straight to glMultMatrixf/glLoadMatrixf
+class mat4
+{
+  public:
+  mat4()
+  {
+    
+  }
+  static mat4 identity()
+  {
+    return from_mat3(mat3::identity(),make_tuple3<float>(0,0,0));
+  }
+  static mat4 from_mat3(const mat3& rotation, const tuple3<float>& translation)
+  {
+    mat4 tmp;
+    for(int col=0;col<3;col++)
+    {
+      for(int row=0;row<3;row++)
+      {
+        tmp.m[col*4+row] = rotation.m[row][col];
+      }
+      tmp.m[col*4+3] = 0;
+    }
+    tmp.m[12] = translation.x;
+    tmp.m[13] = translation.y;
+    tmp.m[14] = translation.z;
+    tmp.m[15] = 1;
+    return tmp;
+  }
+  static mat4 translation(const tuple3<float>& offset)
+  {
+    return from_mat3(mat3::identity(),offset);
+  }
+  static mat4 scaling(const tuple3<float>& factors)
+  {
+    mat4 tmp = identity();
+    tmp.m[0] = factors.x;
+    tmp.m[5] = factors.y;
+    tmp.m[10] = factors.z;
+    return tmp;
+  }
+  //the matrix glRotatef(degrees,axis.x,axis.y,axis.z) would multiply in
+  static mat4 axis_rotation(float degrees, const tuple3<float>& axis);
+  //the matrix glFrustum would multiply in
+  static mat4 frustum(float left, float right, float bottom, float top, float near_plane, float far_plane)
+  {
+    mat4 tmp;
+    for(int c1=0;c1<16;c1++)
+    {
+      tmp.m[c1] = 0;
+    }
+    tmp.m[0] = 2*near_plane/(right-left);
+    tmp.m[5] = 2*near_plane/(top-bottom);
+    tmp.m[8] = (right+left)/(right-left);
+    tmp.m[9] = (top+bottom)/(top-bottom);
+    tmp.m[10] = -(far_plane+near_plane)/(far_plane-near_plane);
+    tmp.m[11] = -1;
+    tmp.m[14] = -2*far_plane*near_plane/(far_plane-near_plane);
+    return tmp;
+  }
+  //same result as rotate_point(point,rotation)+position
+  static mat4 from_rotation_translation(const tuple3<float>& rotation, const tuple3<float>& position)
+  {
+    return from_mat3(mat3::from_rotation(rotation),position);
+  }
+  mat4 operator*(const mat4& other) const
+  {
+    mat4 tmp;
+    for(int col=0;col<4;col++)
+    {
+      for(int row=0;row<4;row++)
+      {
+        tmp.m[col*4+row] = m[row]*other.m[col*4] + m[4+row]*other.m[col*4+1] + m[8+row]*other.m[col*4+2] + m[12+row]*other.m[col*4+3];
+      }
+    }
+    return tmp;
+  }
+  tuple3<float> transform_point(const tuple3<float>& p) const
+  {
+    return make_tuple3(m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12],
+                       m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13],
+                       m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+  }
+  const float* data() const
+  {
+    return m;
+  }
+  float m[16];
+};
+
+class quaternion
+{
+  public:
+  quaternion()
+  {
+    
+  }
+  quaternion(float a,float b,float c,float d)
+  {
+    w = a;
+    x = b;
+    y = c;
+    z = d;
+  }
+  static quaternion from_axis_angle(const tuple3<float>& axis, float angle)
+  {
+    float s = sin(angle/2);
+    return quaternion(cos(angle/2),axis.x*s,axis.y*s,axis.z*s);
+  }
+  //a rotation in the x-y plane is about the z axis, x-z is about -y, and y-z is about x
+  static quaternion from_rotation(const tuple3<float>& rotation)
+  {
+    return from_axis_angle(make_tuple3<float>(1,0,0),rotation.z)*
+           from_axis_angle(make_tuple3<float>(0,-1,0),rotation.x)*
+           from_axis_angle(make_tuple3<float>(0,0,1),rotation.y);
+  }
+  quaternion operator*(const quaternion& o) const
+  {
+    return quaternion(w*o.w - x*o.x - y*o.y - z*o.z,
+                      w*o.x + x*o.w + y*o.z - z*o.y,
+                      w*o.y - x*o.z + y*o.w + z*o.x,
+                      w*o.z + x*o.y - y*o.x + z*o.w);
+  }
+  mat3 to_mat3() const
+  {
+    mat3 tmp;
+    tmp.m[0][0] = 1 - 2*(y*y + z*z);
+    tmp.m[0][1] = 2*(x*y - w*z);
+    tmp.m[0][2] = 2*(x*z + w*y);
+    tmp.m[1][0] = 2*(x*y + w*z);
+    tmp.m[1][1] = 1 - 2*(x*x + z*z);
+    tmp.m[1][2] = 2*(y*z - w*x);
+    tmp.m[2][0] = 2*(x*z - w*y);
+    tmp.m[2][1] = 2*(y*z + w*x);
+    tmp.m[2][2] = 1 - 2*(x*x + y*y);
+    return tmp;
+  }
+  tuple3<float> rotate(const tuple3<float>& p) const
+  {
+    return to_mat3()*p;
+  }
+  float w;
+  float x;
+  float y;
+  float z;
+};
+
+typedef void (*transform_soa_proc)(const mat4& transform, float* x, float* y, float* z, size_t count);
+
+//all the kernels evaluate ((m0*x + m4*y) + m8*z) + m12 in the same order, so the simd paths match this one
+void transform_soa_scalar(const mat4& transform, float* x, float* y, float* z, size_t count)
+{
+  const float* m = transform.m;
+  for(size_t c1=0;c1<count;c1++)
+  {
+    float px = x[c1];
+    float py = y[c1];
+    float pz = z[c1];
+    x[c1] = m[0]*px + m[4]*py + m[8]*pz + m[12];
+    y[c1] = m[1]*px + m[5]*py + m[9]*pz + m[13];
+    z[c1] = m[2]*px + m[6]*py + m[10]*pz + m[14];
+  }
+}
+
+#if SIMD_KERNELS
+__attribute__((target("sse")))
+void transform_soa_sse(const mat4& transform, float* x, float* y, float* z, size_t count)
+{
+  const float* m = transform.m;
+  __m128 col[12];
+  for(int c1=0;c1<12;c1++)
+  {
+    col[c1] = _mm_set1_ps(m[c1+c1/3]); //skips the bottom row of each column
+  }
+  size_t c1 = 0;
+  for(;c1+4<=count;c1+=4)
+  {
+    __m128 px = _mm_loadu_ps(x+c1);
+    __m128 py = _mm_loadu_ps(y+c1);
+    __m128 pz = _mm_loadu_ps(z+c1);
+    _mm_storeu_ps(x+c1,_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0],px),_mm_mul_ps(col[3],py)),_mm_mul_ps(col[6],pz)),col[9]));
+    _mm_storeu_ps(y+c1,_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col[1],px),_mm_mul_ps(col[4],py)),_mm_mul_ps(col[7],pz)),col[10]));
+    _mm_storeu_ps(z+c1,_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(col[2],px),_mm_mul_ps(col[5],py)),_mm_mul_ps(col[8],pz)),col[11]));
+  }
+  transform_soa_scalar(transform,x+c1,y+c1,z+c1,count-c1);
+}
+#endif
+
+#if SIMD_AVX2_KERNELS
+//plain multiplies and adds rather than fma, to match the other kernels
+__attribute__((target("avx2")))
+void transform_soa_avx2(const mat4& transform, float* x, float* y, float* z, size_t count)
+{
+  const float* m = transform.m;
+  size_t c1 = 0;
+  for(;c1+8<=count;c1+=8)
+  {
+    __m256 px = _mm256_loadu_ps(x+c1);
+    __m256 py = _mm256_loadu_ps(y+c1);
+    __m256 pz = _mm256_loadu_ps(z+c1);
+    for(int row=0;row<3;row++)
+    {
+      __m256 result = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_broadcast_ss(m+row),px),
+        _mm256_mul_ps(_mm256_broadcast_ss(m+4+row),py)),
+        _mm256_mul_ps(_mm256_broadcast_ss(m+8+row),pz)),
+        _mm256_broadcast_ss(m+12+row));
+      _mm256_storeu_ps(((row == 0) ? x : ((row == 1) ? y : z))+c1,result);
+    }
+  }
+  transform_soa_scalar(transform,x+c1,y+c1,z+c1,count-c1);
+}
+#endif
+
+transform_soa_proc select_transform_soa()
+{
+#if SIMD_KERNELS
+  __builtin_cpu_init();
+#if SIMD_AVX2_KERNELS
+  if(__builtin_cpu_supports("avx2"))return transform_soa_avx2;
+#endif
+  if(__builtin_cpu_supports("sse"))return transform_soa_sse;
+#endif
+  return transform_soa_scalar;
+}
+
+//transforms x[i],y[i],z[i] in place, 8 or 4 at a time when the cpu allows it
+void transform_soa(const mat4& transform, float* x, float* y, float* z, size_t count)
+{
+  static transform_soa_proc kernel = select_transform_soa();
+  kernel(transform,x,y,z,count);
+}
+
+//structure-of-arrays copy of a batch of positions, the layout transform_soa wants
+class soa_positions
+{
+  public:
+  void transform(const mat4& matrix)
+  {
+    if(!x.empty())transform_soa(matrix,&x[0],&y[0],&z[0],x.size());
+  }
+  void resize(size_t count)
+  {
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+  }
+  size_t size() const
+  {
+    return x.size();
+  }
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+};
+
+mat4 mat4::axis_rotation(float degrees, const tuple3<float>& axis)
+{
+  float length = sqrt(axis.x*axis.x + axis.y*axis.y + axis.z*axis.z);
+  tuple3<float> unit_axis = make_tuple3(axis.x/length,axis.y/length,axis.z/length);
+  return from_mat3(quaternion::from_axis_angle(unit_axis,degrees*PI/180).to_mat3(),make_tuple3<float>(0,0,0));
+}
+
+//the six clip planes of a projection*view matrix, as (a,b,c,d) with a*x+b*y+c*z+d >= 0 on the inside
+class view_frustum
+{
+  public:
+  view_frustum(const mat4& clip)
+  {
+    //Gribb/Hartmann plane extraction: each plane is the last row of the matrix plus or minus one of the others
+    for(int c1=0;c1<6;c1++)
+    {
+      int row = c1/2;
+      float sign = (c1%2 == 0) ? 1 : -1;
+      float length_squared = 0;
+      for(int c2=0;c2<4;c2++)
+      {
+        planes[c1][c2] = clip.m[c2*4+3] + sign*clip.m[c2*4+row];
+        if(c2 < 3)length_squared += planes[c1][c2]*planes[c1][c2];
+      }
+      float length = sqrt(length_squared);
+      for(int c2=0;c2<4;c2++)
+      {
+        planes[c1][c2] /= length;
+      }
+    }
+  }
+  //-1 when the box is completely outside, 1 when completely inside, 0 when it straddles a plane
+  int classify_box(const tuple3<float>& low, const tuple3<float>& high) const
+  {
+    int result = 1;
+    for(int c1=0;c1<6;c1++)
+    {
+      //the corners furthest along and furthest against the plane normal
+      float far_x = (planes[c1][0] > 0) ? high.x : low.x;
+      float far_y = (planes[c1][1] > 0) ? high.y : low.y;
+      float far_z = (planes[c1][2] > 0) ? high.z : low.z;
+      float near_x = (planes[c1][0] > 0) ? low.x : high.x;
+      float near_y = (planes[c1][1] > 0) ? low.y : high.y;
+      float near_z = (planes[c1][2] > 0) ? low.z : high.z;
+      if(planes[c1][0]*far_x + planes[c1][1]*far_y + planes[c1][2]*far_z + planes[c1][3] < 0)return -1;
+      if(planes[c1][0]*near_x + planes[c1][1]*near_y + planes[c1][2]*near_z + planes[c1][3] < 0)result = 0;
+    }
+    return result;
+  }
+  bool sphere_visible(const tuple3<float>& center, float radius) const
+  {
+    for(int c1=0;c1<6;c1++)
+    {
+      if(planes[c1][0]*center.x + planes[c1][1]*center.y + planes[c1][2]*center.z + planes[c1][3] < -radius)return false;
+    }
+    return true;
+  }
+  float planes[6][4]; //left, right, bottom, top, near, far
+};
+
+tuple3<float> rotate_point(const tuple3<float>& point, const tuple3<float>& rotation)
+{
+  return mat3::from_rotation(rotation)*point;
+}
+
+//the polar-coordinate version that the matrices replaced, left in since it makes the rotation order easier to see
+/*#define rotate_in_plane(plane1,plane2,the_point,rot_amount)\
+float plane1 ## plane2 ## _magnitude = sqrt(the_point.plane1 * the_point.plane1 + the_point.plane2 * the_point.plane2);\
+float plane1 ## plane2 ## _angle = atan2(the_point.plane2,the_point.plane1);\
+tuple3<float> plane1 ## plane2 ## _point = the_point;\
+plane1 ## plane2 ## _point.plane1 = plane1 ## plane2 ## _magnitude * cos(plane1 ## plane2 ## _angle + rot_amount);\
+plane1 ## plane2 ## _point.plane2 = plane1 ## plane2 ## _magnitude * sin(plane1 ## plane2 ## _angle + rot_amount);
+
+tuple3<float> rotate_point(const tuple3<float>& point, const tuple3<float>& rotation)
+{
+  tuple3<float> retval;
+  rotate_in_plane(x,y,point,rotation.y)
+  rotate_in_plane(x,z,xy_point,rotation.x)
+  rotate_in_plane(y,z,xz_point,rotation.z)
+  retval = yz_point;
+  return retval;
+}*/
+
+//obsolete version left in to illustrate the concept behind the possibly more obscure generalized version above
+/*tuple3<float> rotate_point(const tuple3<float>& point, float theta_rot, float phi_rot)
+{
+  float magnitude = sqrt(point.x*point.x + point.y*point.y + point.z*point.z);
+  float xz_magnitude = sqrt(point.x*point.x + point.z*point.z);
+  float theta = atan2(point.z,point.x); //radians in a circle aligned with xz plane
+  float phi = atan2(point.y,xz_magnitude); //radians above the xz plane
+  tuple3<float> retval;
+  retval.x = xz_magnitude*cos(theta+theta_rot);
+  retval.z = xz_magnitude*sin(theta+theta_rot);
+  retval.y = magnitude*sin(phi+phi_rot);
+  //printf("in (%f,%f,%f) , out (%f,%f,%f)\n",point.x,point.y,point.z,retval.x,retval.y,retval.z);
+  return retval;
+}*/
+
+//opengl32.dll only exports OpenGL 1.1, so anything newer (buffer objects, etc.) has to be looked up at runtime
+//once a context is current
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_ELEMENT_ARRAY_BUFFER
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+#ifndef GL_POINT_DISTANCE_ATTENUATION
+#define GL_POINT_DISTANCE_ATTENUATION 0x8129
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+
+#ifdef WIN32
+#define gl_get_proc_address(name) ((void*)wglGetProcAddress(name))
+#else
+extern "C" void (*glXGetProcAddressARB(const GLubyte* name))();
+#define gl_get_proc_address(name) ((void*)glXGetProcAddressARB((const GLubyte*)(name)))
+#endif
+
+typedef ptrdiff_t gl_sizeiptr;
+typedef void (APIENTRY *gl_gen_buffers_proc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY *gl_delete_buffers_proc)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRY *gl_bind_buffer_proc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *gl_buffer_data_proc)(GLenum target, gl_sizeiptr size, const GLvoid* data, GLenum usage);
+typedef GLvoid* (APIENTRY *gl_map_buffer_proc)(GLenum target, GLenum access);
+typedef GLboolean (APIENTRY *gl_unmap_buffer_proc)(GLenum target);
+typedef void (APIENTRY *gl_point_parameterfv_proc)(GLenum name, const GLfloat* params);
+typedef GLuint (APIENTRY *gl_create_shader_proc)(GLenum type);
+typedef void (APIENTRY *gl_shader_source_proc)(GLuint shader, GLsizei count, const char** strings, const GLint* lengths);
+typedef void (APIENTRY *gl_compile_shader_proc)(GLuint shader);
+typedef void (APIENTRY *gl_get_shaderiv_proc)(GLuint shader, GLenum name, GLint* value);
+typedef GLuint (APIENTRY *gl_create_program_proc)();
+typedef void (APIENTRY *gl_attach_shader_proc)(GLuint program, GLuint shader);
+typedef void (APIENTRY *gl_bind_attrib_location_proc)(GLuint program, GLuint index, const char* name);
+typedef void (APIENTRY *gl_link_program_proc)(GLuint program);
+typedef void (APIENTRY *gl_get_programiv_proc)(GLuint program, GLenum name, GLint* value);
+typedef void (APIENTRY *gl_use_program_proc)(GLuint program);
+typedef GLint (APIENTRY *gl_get_uniform_location_proc)(GLuint program, const char* name);
+typedef void (APIENTRY *gl_uniform1i_proc)(GLint location, GLint value);
+typedef void (APIENTRY *gl_uniform_matrix4fv_proc)(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+typedef void (APIENTRY *gl_vertex_attrib_pointer_proc)(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid* pointer);
+typedef void (APIENTRY *gl_enable_vertex_attrib_array_proc)(GLuint index);
+typedef void (APIENTRY *gl_disable_vertex_attrib_array_proc)(GLuint index);
+typedef void (APIENTRY *gl_vertex_attrib_divisor_proc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY *gl_draw_arrays_instanced_proc)(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+typedef void (APIENTRY *gl_draw_elements_instanced_proc)(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei instances);
+
+struct gl_extension_table
+{
+  bool loaded;
+  bool have_vbo;
+  bool have_pbo;
+  gl_gen_buffers_proc gen_buffers;
+  gl_delete_buffers_proc delete_buffers;
+  gl_bind_buffer_proc bind_buffer;
+  gl_buffer_data_proc buffer_data;
+  gl_map_buffer_proc map_buffer;
+  gl_unmap_buffer_proc unmap_buffer;
+  bool have_point_parameters;
+  gl_point_parameterfv_proc point_parameterfv;
+  //instanced drawing, per-instance attributes only reach the GPU through a vertex shader
+  bool have_instancing;
+  gl_create_shader_proc create_shader;
+  gl_shader_source_proc shader_source;
+  gl_compile_shader_proc compile_shader;
+  gl_get_shaderiv_proc get_shaderiv;
+  gl_create_program_proc create_program;
+  gl_attach_shader_proc attach_shader;
+  gl_bind_attrib_location_proc bind_attrib_location;
+  gl_link_program_proc link_program;
+  gl_get_programiv_proc get_programiv;
+  gl_use_program_proc use_program;
+  gl_get_uniform_location_proc get_uniform_location;
+  gl_uniform1i_proc uniform1i;
+  gl_uniform_matrix4fv_proc uniform_matrix4fv;
+  gl_vertex_attrib_pointer_proc vertex_attrib_pointer;
+  gl_enable_vertex_attrib_array_proc enable_vertex_attrib_array;
+  gl_disable_vertex_attrib_array_proc disable_vertex_attrib_array;
+  gl_vertex_attrib_divisor_proc vertex_attrib_divisor;
+  gl_draw_arrays_instanced_proc draw_arrays_instanced;
+  gl_draw_elements_instanced_proc draw_elements_instanced;
+  //the program that draws them, see init_instancing_program
+  GLuint instancing_program;
+  GLint instancing_use_uvmap;
+  GLint instancing_spin;
+  GLint instancing_dequantization;
+};
+
+gl_extension_table gl_ext; //zero initialized, so nothing is available until load_gl_extensions runs
+
+bool gl_has_extension(const char* name)
+{
+  const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+  if(extensions == NULL)return false;
+  size_t length = strlen(name);
+  for(const char* found = strstr(extensions,name);found != NULL;found = strstr(found+length,name))
+  {
+    //make sure it's a whole entry in the space separated list, and not just a prefix of a longer name
+    if((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))return true;
+  }
+  return false;
+}
+
+bool gl_version_at_least(int major, int minor)
+{
+  const char* version = (const char*)glGetString(GL_VERSION);
+  int have_major = 0;
+  int have_minor = 0;
+  if(version == NULL || sscanf(version,"%d.%d",&have_major,&have_minor) != 2)return false;
+  return (have_major > major) || (have_major == major && have_minor >= minor);
+}
+
+//looks up the core entry point, falling back to the ARB suffixed one that older drivers only provide
+void* gl_load_proc(const char* name, const char* arb_name)
+{
+  void* proc = gl_get_proc_address(name);
+  if(proc == NULL)proc = gl_get_proc_address(arb_name);
+  return proc;
+}
+
+//generic attribute slots for the per-instance data, clear of the ones some drivers alias to the fixed function arrays
+#define INSTANCE_ATTRIBUTE_ROW0 12
+#define INSTANCE_ATTRIBUTE_COLOR 15
+
+GLuint compile_shader(GLenum type, const char* source)
+{
+  GLuint shader = gl_ext.create_shader(type);
+  gl_ext.shader_source(shader,1,&source,NULL);
+  gl_ext.compile_shader(shader);
+  GLint status = 0;
+  gl_ext.get_shaderiv(shader,GL_COMPILE_STATUS,&status);
+  return status ? shader : 0;
+}
+
+//each instance supplies the top three rows of its object space transform and a color override (used when its alpha
+//isn't 0), otherwise it's the same as the fixed function pipeline with GL_REPLACE texturing. the uniforms are shared by
+//all instances: dequantization maps the stored positions to the mesh's own, and instance_spin rotates every instance
+//about its position, see object3d::instance_spin
+bool init_instancing_program()
+{
+  const char* vertex_source =
+    "#version 110\n"
+    "attribute vec4 instance_row0;\n"
+    "attribute vec4 instance_row1;\n"
+    "attribute vec4 instance_row2;\n"
+    "attribute vec4 instance_color;\n"
+    "uniform mat4 instance_spin;\n"
+    "uniform mat4 dequantization;\n"
+    "void main()\n"
+    "{\n"
+    "  vec3 v = (dequantization*gl_Vertex).xyz;\n"
+    "  vec4 local = vec4(dot(instance_row0.xyz,v),dot(instance_row1.xyz,v),dot(instance_row2.xyz,v),0.0);\n"
+    "  vec4 p = instance_spin*local + vec4(instance_row0.w,instance_row1.w,instance_row2.w,1.0);\n"
+    "  gl_Position = gl_ModelViewProjectionMatrix*p;\n"
+    "  gl_FrontColor = (instance_color.a > 0.0) ? instance_color : gl_Color;\n"
+    "  gl_TexCoord[0] = gl_TextureMatrix[0]*gl_MultiTexCoord0;\n"
+    "}\n";
+  const char* fragment_source =
+    "#version 110\n"
+    "uniform sampler2D uvmap;\n"
+    "uniform bool use_uvmap;\n"
+    "void main()\n"
+    "{\n"
+    "  gl_FragColor = use_uvmap ? texture2D(uvmap,gl_TexCoord[0].st) : gl_Color;\n"
+    "}\n";
+  GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER,vertex_source);
+  GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER,fragment_source);
+  if(vertex_shader == 0 || fragment_shader == 0)return false;
+  GLuint program = gl_ext.create_program();
+  gl_ext.attach_shader(program,vertex_shader);
+  gl_ext.attach_shader(program,fragment_shader);
+  gl_ext.bind_attrib_location(program,INSTANCE_ATTRIBUTE_ROW0,"instance_row0");
+  gl_ext.bind_attrib_location(program,INSTANCE_ATTRIBUTE_ROW0+1,"instance_row1");
+  gl_ext.bind_attrib_location(program,INSTANCE_ATTRIBUTE_ROW0+2,"instance_row2");
+  gl_ext.bind_attrib_location(program,INSTANCE_ATTRIBUTE_COLOR,"instance_color");
+  gl_ext.link_program(program);
+  GLint status = 0;
+  gl_ext.get_programiv(program,GL_LINK_STATUS,&status);
+  if(!status)return false;
+  gl_ext.instancing_program = program;
+  gl_ext.instancing_use_uvmap = gl_ext.get_uniform_location(program,"use_uvmap");
+  gl_ext.instancing_spin = gl_ext.get_uniform_location(program,"instance_spin");
+  gl_ext.instancing_dequantization = gl_ext.get_uniform_location(program,"dequantization");
+  return true;
+}
+
+//must be called with a current context, the first draw() of any panel does this
+void load_gl_extensions()
+{
+  if(gl_ext.loaded)return;
+  gl_ext.loaded = true;
+  if(gl_version_at_least(1,5) || gl_has_extension("GL_ARB_vertex_buffer_object"))
+  {
+    gl_ext.gen_buffers = (gl_gen_buffers_proc)gl_load_proc("glGenBuffers","glGenBuffersARB");
+    gl_ext.delete_buffers = (gl_delete_buffers_proc)gl_load_proc("glDeleteBuffers","glDeleteBuffersARB");
+    gl_ext.bind_buffer = (gl_bind_buffer_proc)gl_load_proc("glBindBuffer","glBindBufferARB");
+    gl_ext.buffer_data = (gl_buffer_data_proc)gl_load_proc("glBufferData","glBufferDataARB");
+    gl_ext.map_buffer = (gl_map_buffer_proc)gl_load_proc("glMapBuffer","glMapBufferARB");
+    gl_ext.unmap_buffer = (gl_unmap_buffer_proc)gl_load_proc("glUnmapBuffer","glUnmapBufferARB");
+    gl_ext.have_vbo = gl_ext.gen_buffers && gl_ext.delete_buffers && gl_ext.bind_buffer && gl_ext.buffer_data;
+    gl_ext.have_pbo = gl_ext.have_vbo && gl_ext.map_buffer && gl_ext.unmap_buffer && (gl_version_at_least(2,1) || gl_has_extension("GL_ARB_pixel_buffer_object"));
+  }
+  if(gl_version_at_least(1,4) || gl_has_extension("GL_ARB_point_parameters"))
+  {
+    gl_ext.point_parameterfv = (gl_point_parameterfv_proc)gl_load_proc("glPointParameterfv","glPointParameterfvARB");
+    gl_ext.have_point_parameters = (gl_ext.point_parameterfv != NULL);
+  }
+  if(gl_ext.have_vbo && gl_version_at_least(2,0) && (gl_version_at_least(3,3) || (gl_has_extension("GL_ARB_draw_instanced") && gl_has_extension("GL_ARB_instanced_arrays"))))
+  {
+    gl_ext.create_shader = (gl_create_shader_proc)gl_get_proc_address("glCreateShader");
+    gl_ext.shader_source = (gl_shader_source_proc)gl_get_proc_address("glShaderSource");
+    gl_ext.compile_shader = (gl_compile_shader_proc)gl_get_proc_address("glCompileShader");
+    gl_ext.get_shaderiv = (gl_get_shaderiv_proc)gl_get_proc_address("glGetShaderiv");
+    gl_ext.create_program = (gl_create_program_proc)gl_get_proc_address("glCreateProgram");
+    gl_ext.attach_shader = (gl_attach_shader_proc)gl_get_proc_address("glAttachShader");
+    gl_ext.bind_attrib_location = (gl_bind_attrib_location_proc)gl_get_proc_address("glBindAttribLocation");
+    gl_ext.link_program = (gl_link_program_proc)gl_get_proc_address("glLinkProgram");
+    gl_ext.get_programiv = (gl_get_programiv_proc)gl_get_proc_address("glGetProgramiv");
+    gl_ext.use_program = (gl_use_program_proc)gl_get_proc_address("glUseProgram");
+    gl_ext.get_uniform_location = (gl_get_uniform_location_proc)gl_get_proc_address("glGetUniformLocation");
+    gl_ext.uniform1i = (gl_uniform1i_proc)gl_get_proc_address("glUniform1i");
+    gl_ext.uniform_matrix4fv = (gl_uniform_matrix4fv_proc)gl_get_proc_address("glUniformMatrix4fv");
+    gl_ext.vertex_attrib_pointer = (gl_vertex_attrib_pointer_proc)gl_get_proc_address("glVertexAttribPointer");
+    gl_ext.enable_vertex_attrib_array = (gl_enable_vertex_attrib_array_proc)gl_get_proc_address("glEnableVertexAttribArray");
+    gl_ext.disable_vertex_attrib_array = (gl_disable_vertex_attrib_array_proc)gl_get_proc_address("glDisableVertexAttribArray");
+    gl_ext.vertex_attrib_divisor = (gl_vertex_attrib_divisor_proc)gl_load_proc("glVertexAttribDivisor","glVertexAttribDivisorARB");
+    gl_ext.draw_arrays_instanced = (gl_draw_arrays_instanced_proc)gl_load_proc("glDrawArraysInstanced","glDrawArraysInstancedARB");
+    gl_ext.draw_elements_instanced = (gl_draw_elements_instanced_proc)gl_load_proc("glDrawElementsInstanced","glDrawElementsInstancedARB");
+    gl_ext.have_instancing = gl_ext.create_shader && gl_ext.shader_source && gl_ext.compile_shader && gl_ext.get_shaderiv &&
+                             gl_ext.create_program && gl_ext.attach_shader && gl_ext.bind_attrib_location && gl_ext.link_program &&
+                             gl_ext.get_programiv && gl_ext.use_program && gl_ext.get_uniform_location && gl_ext.uniform1i && gl_ext.uniform_matrix4fv &&
+                             gl_ext.vertex_attrib_pointer && gl_ext.enable_vertex_attrib_array && gl_ext.disable_vertex_attrib_array &&
+                             gl_ext.vertex_attrib_divisor && gl_ext.draw_arrays_instanced && gl_ext.draw_elements_instanced;
+    if(gl_ext.have_instancing)gl_ext.have_instancing = init_instancing_program();
+  }
+}
+
+//where each attribute sits inside one vertex of an interleaved array, and in what type
+struct vertex_layout
+{
+  GLenum position_type;
+  GLenum texcoord_type;
+  GLenum color_type;
+  size_t texcoord_offset;
+  size_t color_offset;
+  size_t stride;
+};
+
+//vertex_type is tightly packed floats: pos, then texcoords, then color
+vertex_layout float_vertex_layout()
+{
+  vertex_layout layout;
+  layout.position_type = GL_FLOAT;
+  layout.texcoord_type = GL_FLOAT;
+  layout.color_type = GL_FLOAT;
+  layout.texcoord_offset = sizeof(tuple3<float>);
+  layout.color_offset = layout.texcoord_offset+sizeof(tuple2<float>);
+  layout.stride = sizeof(vertex_type);
+  return layout;
+}
+
+//bare float positions, with no texcoords or colors at all
+vertex_layout point_vertex_layout()
+{
+  vertex_layout layout;
+  layout.position_type = GL_FLOAT;
+  layout.texcoord_type = 0;
+  layout.color_type = 0;
+  layout.texcoord_offset = 0;
+  layout.color_offset = 0;
+  layout.stride = sizeof(tuple3<float>);
+  return layout;
+}
+
+//base is NULL when the data is in a bound buffer object, otherwise it points at the client side array
+//use_colors false leaves the color array off, for callers that set one color for the whole draw
+void set_vertex_pointers(const vertex_layout& layout, const unsigned char* base, bool use_uvmap, bool use_colors = true)
+{
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3,layout.position_type,layout.stride,base);
+  if(use_uvmap)
+  {
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2,layout.texcoord_type,layout.stride,base+layout.texcoord_offset);
+  }
+  else if(layout.color_type != 0 && use_colors)
+  {
+    glEnableClientState(GL_COLOR_ARRAY);
+    glColorPointer(4,layout.color_type,layout.stride,base+layout.color_offset);
+  }
+}
+
+void clear_vertex_pointers()
+{
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+short quantize_short(float value, float offset, float scale)
+{
+  float q = (value-offset)/scale;
+  if(q > 32767)q = 32767;
+  if(q < -32767)q = -32767;
+  return short((q < 0) ? (q-.5f) : (q+.5f));
+}
+
+unsigned char quantize_unorm8(float value)
+{
+  if(value < 0)value = 0;
+  if(value > 1)value = 1;
+  return (unsigned char)(value*255+.5f);
+}
+
+//compact encoding of a triangle list: rgba8 colors, 16 bit texcoords quantized against the texcoord bounds, and optionally
+//16 bit positions quantized against the bounding box (16 bytes per vertex that way, 20 with float positions, vs 36 for vertex_type).
+//the offsets/scales undo the quantization, the renderer applies them with the modelview and texture matrices
+class compact_mesh
+{
+  public:
+  compact_mesh()
+  {
+    quantized_positions = false;
+    count = 0;
+  }
+  void encode(const vertex_type* vertices, size_t vertex_total, bool quantize_positions)
+  {
+    quantized_positions = quantize_positions;
+    count = vertex_total;
+    tuple3<float> pos_min = make_tuple3<float>(0,0,0);
+    tuple3<float> pos_max = pos_min;
+    tuple2<float> uv_min = make_tuple2<float>(0,0);
+    tuple2<float> uv_max = uv_min;
+    for(size_t c1=0;c1<count;c1++)
+    {
+      const vertex_type& vert = vertices[c1];
+      if(c1 == 0)
+      {
+        pos_min = pos_max = vert.pos;
+        uv_min = uv_max = vert.texcoords;
+      }
+      pos_min = make_tuple3(std::min(pos_min.x,vert.pos.x),std::min(pos_min.y,vert.pos.y),std::min(pos_min.z,vert.pos.z));
+      pos_max = make_tuple3(std::max(pos_max.x,vert.pos.x),std::max(pos_max.y,vert.pos.y),std::max(pos_max.z,vert.pos.z));
+      uv_min = make_tuple2(std::min(uv_min.x,vert.texcoords.x),std::min(uv_min.y,vert.texcoords.y));
+      uv_max = make_tuple2(std::max(uv_max.x,vert.texcoords.x),std::max(uv_max.y,vert.texcoords.y));
+    }
+    position_offset = make_tuple3<float>(0,0,0);
+    position_scale = make_tuple3<float>(1,1,1);
+    if(quantized_positions)
+    {
+      position_offset = make_tuple3((pos_min.x+pos_max.x)/2,(pos_min.y+pos_max.y)/2,(pos_min.z+pos_max.z)/2);
+      position_scale = make_tuple3(quantization_step(pos_min.x,pos_max.x),quantization_step(pos_min.y,pos_max.y),quantization_step(pos_min.z,pos_max.z));
+    }
+    texcoord_offset = make_tuple2((uv_min.x+uv_max.x)/2,(uv_min.y+uv_max.y)/2);
+    //power of two steps for texcoords, so the usual fractions like 0, .25 and 1 come back out exactly
+    texcoord_scale = make_tuple2(power_of_two_step(uv_min.x,uv_max.x),power_of_two_step(uv_min.y,uv_max.y));
+    
+    vertex_layout layout = get_layout();
+    data.resize(count*layout.stride);
+    for(size_t c1=0;c1<count;c1++)
+    {
+      const vertex_type& vert = vertices[c1];
+      unsigned char* out = &data[c1*layout.stride];
+      if(quantized_positions)
+      {
+        short pos[4] = {quantize_short(vert.pos.x,position_offset.x,position_scale.x),
+                        quantize_short(vert.pos.y,position_offset.y,position_scale.y),
+                        quantize_short(vert.pos.z,position_offset.z,position_scale.z),0};
+        memcpy(out,pos,sizeof(pos));
+      }
+      else
+      {
+        float pos[3] = {vert.pos.x,vert.pos.y,vert.pos.z};
+        memcpy(out,pos,sizeof(pos));
+      }
+      short uv[2] = {quantize_short(vert.texcoords.x,texcoord_offset.x,texcoord_scale.x),
+                     quantize_short(vert.texcoords.y,texcoord_offset.y,texcoord_scale.y)};
+      memcpy(out+layout.texcoord_offset,uv,sizeof(uv));
+      unsigned char* rgba = out+layout.color_offset;
+      rgba[0] = quantize_unorm8(vert.color.w);
+      rgba[1] = quantize_unorm8(vert.color.x);
+      rgba[2] = quantize_unorm8(vert.color.y);
+      rgba[3] = quantize_unorm8(vert.color.z);
+    }
+  }
+  //decoded position of one vertex, in the same space the triangles were in
+  tuple3<float> position(size_t index) const
+  {
+    const unsigned char* in = &data[index*get_layout().stride];
+    if(quantized_positions)
+    {
+      short pos[3];
+      memcpy(pos,in,sizeof(pos));
+      return make_tuple3(position_offset.x+pos[0]*position_scale.x,position_offset.y+pos[1]*position_scale.y,position_offset.z+pos[2]*position_scale.z);
+    }
+    float pos[3];
+    memcpy(pos,in,sizeof(pos));
+    return make_tuple3(pos[0],pos[1],pos[2]);
+  }
+  vertex_type vertex(size_t index) const
+  {
+    vertex_layout layout = get_layout();
+    const unsigned char* in = &data[index*layout.stride];
+    short uv[2];
+    memcpy(uv,in+layout.texcoord_offset,sizeof(uv));
+    const unsigned char* rgba = in+layout.color_offset;
+    vertex_type vert;
+    vert.pos = position(index);
+    vert.texcoords = make_tuple2(texcoord_offset.x+uv[0]*texcoord_scale.x,texcoord_offset.y+uv[1]*texcoord_scale.y);
+    vert.color = make_tuple4(rgba[0]/255.0f,rgba[1]/255.0f,rgba[2]/255.0f,rgba[3]/255.0f);
+    return vert;
+  }
+  vertex_layout get_layout() const
+  {
+    vertex_layout layout;
+    layout.position_type = quantized_positions ? GL_SHORT : GL_FLOAT;
+    layout.texcoord_type = GL_SHORT;
+    layout.color_type = GL_UNSIGNED_BYTE;
+    layout.texcoord_offset = quantized_positions ? 4*sizeof(short) : 3*sizeof(float);
+    layout.color_offset = layout.texcoord_offset+2*sizeof(short);
+    layout.stride = layout.color_offset+4;
+    return layout;
+  }
+  //same as apply_position_dequantization, for folding into matrices built on the CPU
+  mat4 position_dequantization() const
+  {
+    return mat4::translation(position_offset)*mat4::scaling(position_scale);
+  }
+  //glTranslate/glScale that maps the stored positions back to object space
+  void apply_position_dequantization()
+  {
+    glTranslatef(position_offset.x,position_offset.y,position_offset.z);
+    glScalef(position_scale.x,position_scale.y,position_scale.z);
+  }
+  //same for texcoords, expects the texture matrix to be the current one (the caller resets it after drawing)
+  void apply_texcoord_dequantization()
+  {
+    glTranslatef(texcoord_offset.x,texcoord_offset.y,0);
+    glScalef(texcoord_scale.x,texcoord_scale.y,1);
+  }
+  static float quantization_step(float min, float max)
+  {
+    return (max > min) ? (max-min)/2/32767 : 1;
+  }
+  static float power_of_two_step(float min, float max)
+  {
+    int exponent;
+    frexp(quantization_step(min,max),&exponent);
+    return ldexp(1.0f,exponent);
+  }
+  bool quantized_positions;
+  size_t count;
+  std::vector<unsigned int> indices; //empty for a plain triangle list
+  tuple3<float> position_offset;
+  tuple3<float> position_scale;
+  tuple2<float> texcoord_offset;
+  tuple2<float> texcoord_scale;
+  std::vector<unsigned char> data;
+};
+
+//the client side arrays for whichever representation an object is currently holding its geometry in
+struct vertex_source
+{
+  const unsigned char* vertices;
+  size_t vertex_count;
+  vertex_layout layout;
+  const unsigned int* indices; //NULL for a plain triangle list
+  size_t index_count;
+};
+
+vertex_source make_vertex_source(const void* vertices, size_t vertex_count, const vertex_layout& layout, const std::vector<unsigned int>& indices)
+{
+  vertex_source source;
+  source.vertices = (const unsigned char*)vertices;
+  source.vertex_count = vertex_count;
+  source.layout = layout;
+  source.indices = indices.empty() ? NULL : &indices[0];
+  source.index_count = indices.size();
+  return source;
+}
+
+//fallback for drivers without buffer objects, plain vertex arrays are still in OpenGL 1.1
+void draw_vertex_source(const vertex_source& source, int gl_mode, bool use_uvmap, bool use_colors = true)
+{
+  if(source.vertex_count == 0)return;
+  set_vertex_pointers(source.layout,source.vertices,use_uvmap,use_colors);
+  if(source.indices != NULL)glDrawElements(gl_mode,source.index_count,GL_UNSIGNED_INT,source.indices);
+  else glDrawArrays(gl_mode,0,source.vertex_count);
+  clear_vertex_pointers();
+}
+
+//orders vertices by value, -0 and 0 compare equal so they weld together
+int compare_vertices(const vertex_type& a, const vertex_type& b)
+{
+  const float fa[9] = {a.pos.x,a.pos.y,a.pos.z,a.texcoords.x,a.texcoords.y,a.color.w,a.color.x,a.color.y,a.color.z};
+  const float fb[9] = {b.pos.x,b.pos.y,b.pos.z,b.texcoords.x,b.texcoords.y,b.color.w,b.color.x,b.color.y,b.color.z};
+  for(int c1=0;c1<9;c1++)
+  {
+    if(fa[c1] < fb[c1])return -1;
+    if(fa[c1] > fb[c1])return 1;
+  }
+  return 0;
+}
+
+struct vertex_index_less
+{
+  const vertex_type* vertices;
+  bool operator()(unsigned int a, unsigned int b) const
+  {
+    int order = compare_vertices(vertices[a],vertices[b]);
+    return (order != 0) ? (order < 0) : (a < b);
+  }
+};
+
+//shared vertex array plus three indices per triangle, so a vertex used by several triangles is stored (and uploaded) once
+class indexed_mesh
+{
+  public:
+  //merges vertices of a plain triangle list whose position, texcoords and color compare equal as floats (so -0 and 0
+  //merge too, see compare_vertices), keeping the first-use order of the vertices so nearby triangles still reference
+  //nearby memory
+  void weld(const triangle_list& triangles)
+  {
+    vertices.clear();
+    indices.clear();
+    if(triangles.empty())return;
+    const vertex_type* source = triangles[0].verts; //the triangles are an unbroken run of vertex_type
+    unsigned int source_count = triangles.size()*3;
+    std::vector<unsigned int> order(source_count);
+    for(unsigned int c1=0;c1<source_count;c1++)
+    {
+      order[c1] = c1;
+    }
+    vertex_index_less less;
+    less.vertices = source;
+    std::sort(order.begin(),order.end(),less);
+    //every vertex points at the first (lowest index) copy of itself
+    std::vector<unsigned int> first_copy(source_count);
+    for(unsigned int c1=0;c1<source_count;c1++)
+    {
+      bool same_as_previous = (c1 > 0) && (compare_vertices(source[order[c1-1]],source[order[c1]]) == 0);
+      first_copy[order[c1]] = same_as_previous ? first_copy[order[c1-1]] : order[c1];
+    }
+    std::vector<unsigned int> remap(source_count,~0u);
+    indices.resize(source_count);
+    for(unsigned int c1=0;c1<source_count;c1++)
+    {
+      unsigned int representative = first_copy[c1];
+      if(remap[representative] == ~0u)
+      {
+        remap[representative] = vertices.size();
+        vertices.push_back(source[representative]);
+      }
+      indices[c1] = remap[representative];
+    }
+  }
+  std::vector<vertex_type> vertices;
+  std::vector<unsigned int> indices;
+};
+
+//GPU-resident copy of an object's vertices, uploaded once and then drawn with a single glDrawArrays per frame
+//instead of resubmitting every vertex through glBegin/glEnd
+class mesh_buffer
+{
+  public:
+  mesh_buffer()
+  {
+    buffer_id = 0;
+    index_buffer_id = 0;
+    vertex_count = 0;
+    index_count = 0;
+    index_type = GL_UNSIGNED_SHORT;
+    layout = float_vertex_layout();
+  }
+  ~mesh_buffer()
+  {
+    release();
+  }
+  void release()
+  {
+    if(buffer_id != 0 && gl_ext.have_vbo)gl_ext.delete_buffers(1,&buffer_id);
+    if(index_buffer_id != 0 && gl_ext.have_vbo)gl_ext.delete_buffers(1,&index_buffer_id);
+    buffer_id = 0;
+    index_buffer_id = 0;
+    vertex_count = 0;
+    index_count = 0;
+  }
+  void upload(const vertex_source& source)
+  {
+    if(buffer_id == 0)gl_ext.gen_buffers(1,&buffer_id);
+    vertex_count = source.vertex_count;
+    layout = source.layout;
+    gl_ext.bind_buffer(GL_ARRAY_BUFFER,buffer_id);
+    gl_ext.buffer_data(GL_ARRAY_BUFFER,layout.stride*vertex_count,vertex_count ? source.vertices : NULL,GL_STATIC_DRAW);
+    gl_ext.bind_buffer(GL_ARRAY_BUFFER,0);
+    index_count = source.index_count;
+    if(source.indices != NULL)
+    {
+      if(index_buffer_id == 0)gl_ext.gen_buffers(1,&index_buffer_id);
+      gl_ext.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,index_buffer_id);
+      if(vertex_count <= 65536)
+      {
+        //half the index bandwidth whenever the vertices fit
+        std::vector<unsigned short> short_indices(source.indices,source.indices+index_count);
+        index_type = GL_UNSIGNED_SHORT;
+        gl_ext.buffer_data(GL_ELEMENT_ARRAY_BUFFER,sizeof(unsigned short)*index_count,&short_indices[0],GL_STATIC_DRAW);
+      }
+      else
+      {
+        index_type = GL_UNSIGNED_INT;
+        gl_ext.buffer_data(GL_ELEMENT_ARRAY_BUFFER,sizeof(unsigned int)*index_count,source.indices,GL_STATIC_DRAW);
+      }
+      gl_ext.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,0);
+    }
+  }
+  void draw(int gl_mode, bool use_uvmap)
+  {
+    if(vertex_count == 0)return;
+    bind(use_uvmap);
+    draw_bound(gl_mode);
+    unbind();
+  }
+  //bind once and draw_bound repeatedly to draw the same mesh several times without setting it up again each time
+  void bind(bool use_uvmap)
+  {
+    gl_ext.bind_buffer(GL_ARRAY_BUFFER,buffer_id);
+    set_vertex_pointers(layout,NULL,use_uvmap);
+    if(index_count > 0)gl_ext.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,index_buffer_id);
+  }
+  void draw_bound(int gl_mode)
+  {
+    if(index_count > 0)glDrawElements(gl_mode,index_count,index_type,NULL);
+    else glDrawArrays(gl_mode,0,vertex_count);
+  }
+  //needs gl_ext.have_instancing, and the per-instance attributes set up
+  void draw_bound_instanced(int gl_mode, size_t instance_count)
+  {
+    if(index_count > 0)gl_ext.draw_elements_instanced(gl_mode,index_count,index_type,NULL,instance_count);
+    else gl_ext.draw_arrays_instanced(gl_mode,0,vertex_count,instance_count);
+  }
+  void unbind()
+  {
+    if(index_count > 0)gl_ext.bind_buffer(GL_ELEMENT_ARRAY_BUFFER,0);
+    clear_vertex_pointers();
+    gl_ext.bind_buffer(GL_ARRAY_BUFFER,0);
+  }
+  unsigned int buffer_id;
+  unsigned int index_buffer_id;
+  size_t vertex_count;
+  size_t index_count;
+  GLenum index_type;
+  vertex_layout layout;
+};
+
+//a file mapped read only into memory, empty if it couldn't be opened
+class mapped_file
+{
+  public:
+  mapped_file() : data(NULL), size(0)
+  {
+#ifdef WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#endif
+  }
+  ~mapped_file()
+  {
+    close();
+  }
+  bool open(const char* path)
+  {
+    close();
+#ifdef WIN32
+    file = CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+    if(file == INVALID_HANDLE_VALUE)return false;
+    DWORD high = 0;
+    DWORD low = GetFileSize(file,&high);
+    size = (size_t(high) << 16 << 16) | low;
+    if(size > 0)mapping = CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+    if(mapping != NULL)data = (const unsigned char*)MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+#else
+    int file = ::open(path,O_RDONLY);
+    if(file < 0)return false;
+    struct stat info;
+    if(fstat(file,&info) == 0 && info.st_size > 0)
+    {
+      size = size_t(info.st_size);
+      void* view = mmap(NULL,size,PROT_READ,MAP_PRIVATE,file,0);
+      if(view != MAP_FAILED)data = (const unsigned char*)view;
+    }
+    ::close(file); //the mapping keeps the file
+#endif
+    if(data == NULL)close();
+    return data != NULL;
+  }
+  void close()
+  {
+#ifdef WIN32
+    if(data != NULL)UnmapViewOfFile(data);
+    if(mapping != NULL)CloseHandle(mapping);
+    if(file != INVALID_HANDLE_VALUE)CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    mapping = NULL;
+#else
+    if(data != NULL)munmap((void*)data,size);
+#endif
+    data = NULL;
+    size = 0;
+  }
+  const unsigned char* data;
+  size_t size;
+  
+  private:
+#ifdef WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+  mapped_file(const mapped_file&);
+  mapped_file& operator=(const mapped_file&);
+};
+
+//byte order of the pixels in an image file, converted to the rgba texture_image keeps
+enum pixel_layout {PIXELS_RGB, PIXELS_BGR, PIXELS_RGBA, PIXELS_BGRA, PIXELS_BGRX};
+
+int pixel_layout_bytes(pixel_layout layout)
+{
+  return (layout == PIXELS_RGB || layout == PIXELS_BGR) ? 3 : 4;
+}
+
+typedef void (*convert_pixels_proc)(const unsigned char* source, unsigned char* dest, size_t count, pixel_layout layout);
+
+void convert_pixels_scalar(const unsigned char* source, unsigned char* dest, size_t count, pixel_layout layout)
+{
+  int bytes = pixel_layout_bytes(layout);
+  bool swap = (layout == PIXELS_BGR || layout == PIXELS_BGRA || layout == PIXELS_BGRX);
+  bool has_alpha = (layout == PIXELS_RGBA || layout == PIXELS_BGRA);
+  for(size_t c1=0;c1<count;c1++)
+  {
+    const unsigned char* p = source+c1*bytes;
+    dest[4*c1] = swap ? p[2] : p[0];
+    dest[4*c1+1] = p[1];
+    dest[4*c1+2] = swap ? p[0] : p[2];
+    dest[4*c1+3] = has_alpha ? p[3] : 255;
+  }
+}
+
+#if SIMD_KERNELS
+//one pshufb turns 4 packed pixels into 4 rgba ones, missing alpha is or'ed in afterwards
+__attribute__((target("ssse3")))
+void convert_pixels_ssse3(const unsigned char* source, unsigned char* dest, size_t count, pixel_layout layout)
+{
+  int bytes = pixel_layout_bytes(layout);
+  bool swap = (layout == PIXELS_BGR || layout == PIXELS_BGRA || layout == PIXELS_BGRX);
+  bool has_alpha = (layout == PIXELS_RGBA || layout == PIXELS_BGRA);
+  char order[16];
+  for(int c1=0;c1<4;c1++)
+  {
+    order[4*c1] = char(c1*bytes+(swap ? 2 : 0));
+    order[4*c1+1] = char(c1*bytes+1);
+    order[4*c1+2] = char(c1*bytes+(swap ? 0 : 2));
+    order[4*c1+3] = has_alpha ? char(c1*bytes+3) : char(-128); //a set high bit makes pshufb write 0
+  }
+  __m128i shuffle = _mm_loadu_si128((const __m128i*)order);
+  __m128i alpha = has_alpha ? _mm_setzero_si128() : _mm_set1_epi32(int(0xff000000));
+  size_t c1 = 0;
+  //every load reads 16 bytes, so with 3 byte pixels the last few are left to the scalar loop rather than reading past the row
+  size_t lookahead = (bytes == 3) ? 2 : 0;
+  for(;c1+4+lookahead<=count;c1+=4)
+  {
+    __m128i pixels = _mm_loadu_si128((const __m128i*)(source+c1*bytes));
+    _mm_storeu_si128((__m128i*)(dest+4*c1),_mm_or_si128(_mm_shuffle_epi8(pixels,shuffle),alpha));
+  }
+  convert_pixels_scalar(source+c1*bytes,dest+4*c1,count-c1,layout);
+}
+#endif
+
+convert_pixels_proc select_convert_pixels()
+{
+#if SIMD_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("ssse3"))return convert_pixels_ssse3;
+#endif
+  return convert_pixels_scalar;
+}
+
+//count pixels from source, laid out as layout, to rgba at dest
+void convert_pixels(const unsigned char* source, unsigned char* dest, size_t count, pixel_layout layout)
+{
+  static convert_pixels_proc kernel = select_convert_pixels();
+  kernel(source,dest,count,layout);
+}
+
+typedef void (*downsample_pixels_proc)(const unsigned char* row0, const unsigned char* row1, unsigned char* dest, size_t count);
+
+//2x2 box filter: each rgba pixel of dest is the rounded average of two neighbouring pixels of row0 and the two below them
+//in row1, so row0 and row1 have 2*count pixels
+void downsample_pixels_scalar(const unsigned char* row0, const unsigned char* row1, unsigned char* dest, size_t count)
+{
+  for(size_t c1=0;c1<count*4;c1++)
+  {
+    size_t source = (c1/4)*8+(c1%4);
+    dest[c1] = (unsigned char)((row0[source]+row0[source+4]+row1[source]+row1[source+4]+2) >> 2);
+  }
+}
+
+#if SIMD_KERNELS
+//2 pixels at a time, summed in 16 bit lanes so the rounding is exactly the scalar version's (two _mm_avg_epu8 would round twice)
+__attribute__((target("sse2")))
+void downsample_pixels_sse2(const unsigned char* row0, const unsigned char* row1, unsigned char* dest, size_t count)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i two = _mm_set1_epi16(2);
+  size_t c1 = 0;
+  for(;c1+2<=count;c1+=2)
+  {
+    __m128i top = _mm_loadu_si128((const __m128i*)(row0+8*c1));
+    __m128i bottom = _mm_loadu_si128((const __m128i*)(row1+8*c1));
+    //pixels 0,1 and 2,3 of both rows, added vertically
+    __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top,zero),_mm_unpacklo_epi8(bottom,zero));
+    __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top,zero),_mm_unpackhi_epi8(bottom,zero));
+    //then horizontally, each half's second pixel onto its first
+    low = _mm_add_epi16(low,_mm_srli_si128(low,8));
+    high = _mm_add_epi16(high,_mm_srli_si128(high,8));
+    __m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(low,high),two),2);
+    _mm_storel_epi64((__m128i*)(dest+4*c1),_mm_packus_epi16(sum,zero));
+  }
+  downsample_pixels_scalar(row0+8*c1,row1+8*c1,dest+4*c1,count-c1);
+}
+#endif
+
+downsample_pixels_proc select_downsample_pixels()
+{
+#if SIMD_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2"))return downsample_pixels_sse2;
+#endif
+  return downsample_pixels_scalar;
+}
+
+void downsample_pixels(const unsigned char* row0, const unsigned char* row1, unsigned char* dest, size_t count)
+{
+  static downsample_pixels_proc kernel = select_downsample_pixels();
+  kernel(row0,row1,dest,count);
+}
+
+//where the pixels of an image file are and how they're stored, as found by parse_bmp/parse_netpbm in the file's bytes
+struct image_file_layout
+{
+  int width;
+  int height;
+  const unsigned char* top_row; //rows go from top to bottom
+  ptrdiff_t row_stride; //negative for files stored bottom row first
+  pixel_layout layout;
+};
+
+//largest width or height accepted from an image file, which also keeps the size computations from overflowing a 32 bit size_t
+#define MAX_IMAGE_SIZE 16384
+
+uint32_t read_le32(const unsigned char* p)
+{
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+//uncompressed 24 and 32 bit windows bitmaps, the kind texture.bmp is
+bool parse_bmp(const unsigned char* file, size_t size, image_file_layout& image)
+{
+  if(size < 54 || file[0] != 'B' || file[1] != 'M')return false;
+  uint32_t pixel_offset = read_le32(file+10);
+  uint32_t header_size = read_le32(file+14);
+  int32_t width = int32_t(read_le32(file+18));
+  int32_t height = int32_t(read_le32(file+22));
+  unsigned int bits = file[28] | (file[29] << 8);
+  uint32_t compression = read_le32(file+30);
+  if(header_size < 40 || width <= 0 || width > MAX_IMAGE_SIZE || height == 0 || height > MAX_IMAGE_SIZE || height < -MAX_IMAGE_SIZE)return false;
+  bool top_down = (height < 0); //a negative height means the rows are stored top row first
+  if(top_down)height = -height;
+  if(bits == 24 && compression == 0)image.layout = PIXELS_BGR;
+  else if(bits == 32 && compression == 0)image.layout = PIXELS_BGRX; //the fourth byte is unused
+  else if(bits == 32 && compression == 3 && size >= 14+40+12 && read_le32(file+54) == 0xff0000 && read_le32(file+58) == 0xff00 && read_le32(file+62) == 0xff)
+  {
+    //bitfields, only accepted in the usual bgra order
+    bool alpha = (header_size >= 56 && size >= 14+56 && read_le32(file+66) == 0xff000000);
+    image.layout = alpha ? PIXELS_BGRA : PIXELS_BGRX;
+  }
+  else return false;
+  size_t stride = ((size_t(width)*bits/8)+3) & ~size_t(3); //rows are padded to 4 bytes
+  if(pixel_offset > size || size_t(height) > (size-pixel_offset)/stride)return false;
+  image.width = width;
+  image.height = height;
+  image.row_stride = top_down ? ptrdiff_t(stride) : -ptrdiff_t(stride);
+  image.top_row = file+pixel_offset+(top_down ? 0 : stride*(height-1));
+  return true;
+}
+
+//the next whitespace separated token of a netpbm header, skipping # comments. advances position
+bool netpbm_token(const unsigned char* file, size_t size, size_t& position, char* token, size_t token_size)
+{
+  while(position < size)
+  {
+    if(file[position] == '#')
+    {
+      while(position < size && file[position] != '\n')position++;
+    }
+    else if(isspace(file[position]))position++;
+    else break;
+  }
+  size_t length = 0;
+  while(position < size && !isspace(file[position]) && length+1 < token_size)
+  {
+    token[length++] = char(file[position++]);
+  }
+  token[length] = 0;
+  return length > 0;
+}
+
+//binary ppm (P6) and pam (P7) with 8 bit rgb or rgb_alpha samples
+bool parse_netpbm(const unsigned char* file, size_t size, image_file_layout& image)
+{
+  if(size < 3 || file[0] != 'P' || (file[1] != '6' && file[1] != '7'))return false;
+  size_t position = 2;
+  char token[64];
+  long width = 0;
+  long height = 0;
+  long depth = 3;
+  long maxval = 0;
+  if(file[1] == '6')
+  {
+    long* fields[3] = {&width,&height,&maxval};
+    for(int c1=0;c1<3;c1++)
+    {
+      if(!netpbm_token(file,size,position,token,sizeof(token)))return false;
+      *fields[c1] = strtol(token,NULL,10);
+    }
+  }
+  else
+  {
+    //KEY value lines up to ENDHDR
+    while(true)
+    {
+      if(!netpbm_token(file,size,position,token,sizeof(token)))return false;
+      if(strcmp(token,"ENDHDR") == 0)break;
+      char value[64];
+      bool is_tupltype = (strcmp(token,"TUPLTYPE") == 0);
+      if(!netpbm_token(file,size,position,value,sizeof(value)))return false;
+      if(strcmp(token,"WIDTH") == 0)width = strtol(value,NULL,10);
+      else if(strcmp(token,"HEIGHT") == 0)height = strtol(value,NULL,10);
+      else if(strcmp(token,"DEPTH") == 0)depth = strtol(value,NULL,10);
+      else if(strcmp(token,"MAXVAL") == 0)maxval = strtol(value,NULL,10);
+      else if(is_tupltype && strcmp(value,"RGB") != 0 && strcmp(value,"RGB_ALPHA") != 0)return false;
+    }
+  }
+  position++; //the single whitespace character ending the header
+  if(width <= 0 || width > MAX_IMAGE_SIZE || height <= 0 || height > MAX_IMAGE_SIZE || maxval != 255 || (depth != 3 && depth != 4))return false;
+  size_t stride = size_t(width)*depth;
+  if(position > size || size_t(height) > (size-position)/stride)return false;
+  image.width = int(width);
+  image.height = int(height);
+  image.layout = (depth == 4) ? PIXELS_RGBA : PIXELS_RGB;
+  image.top_row = file+position;
+  image.row_stride = ptrdiff_t(stride);
+  return true;
+}
+
+class texture_image;
+//uvmaps leave the atlas (see texture_atlas below) when they're deleted
+void remove_from_atlas(texture_image* image);
+
+class texture_image
+{
+  public:
+  //the GL texture object is created on the first apply_texture, since objects (and their uvmaps) are usually
+  //generated before any context is current
+  texture_image()
+  {
+    texture_id = 0;
+    data = NULL;
+    init_streaming();
+    mip_level_limit = -1;
+    change_size(128,128);
+  }
+  texture_image(const texture_image& other)
+  {
+    texture_id = 0;
+    data = NULL;
+    init_streaming();
+    mip_level_limit = -1;
+    change_size(other.texture_width,other.texture_height);
+    memcpy(data,other.data,texture_width*texture_height*4);
+  }
+  ~texture_image()
+  {
+    if(texture_id != 0)glDeleteTextures(1,&texture_id);
+    if(pbo_ids[0] != 0)gl_ext.delete_buffers(2,pbo_ids);
+    remove_from_atlas(this);
+    free(data);
+  }
+  void init_streaming()
+  {
+    streaming = false;
+    pbo_ids[0] = pbo_ids[1] = 0;
+    pbo_index = 0;
+    pbo_pending = false;
+  }
+  //for textures that get redrawn every frame: instead of a synchronous glTexSubImage2D from data, the texels are copied
+  //into one of two pixel buffer objects and the texture is updated from it on the next bind, so the transfer can
+  //overlap with the GPU still sampling the previous contents and the CPU drawing the next frame's
+  void enable_streaming()
+  {
+    streaming = true;
+  }
+  //returns false, keeping the old texels and size, when the new size doesn't fit in memory
+  bool change_size(int new_width, int new_height)
+  {
+    if(new_width <= 0 || new_height <= 0 || size_t(new_height) > size_t(-1)/4/size_t(new_width))return false;
+    unsigned char* new_data = (unsigned char*)malloc(sizeof(unsigned char)*size_t(new_width)*new_height*4);
+    if(new_data == NULL)return false;
+    if(data)free(data);
+    data = new_data;
+    texture_width = new_width;
+    texture_height = new_height;
+    needs_full_upload = true;
+    clear_dirty_rect();
+    mip_levels.clear();
+    return true;
+  }
+  //grows the region that the next apply_texture has to send to the GPU to include (x,y)
+  void mark_dirty(int x, int y)
+  {
+    if(x < dirty_x1)dirty_x1 = x;
+    if(y < dirty_y1)dirty_y1 = y;
+    if(x >= dirty_x2)dirty_x2 = x+1;
+    if(y >= dirty_y2)dirty_y2 = y+1;
+  }
+  //for code that writes to data directly instead of going through putpixel
+  void mark_all_dirty()
+  {
+    mark_dirty(0,0);
+    mark_dirty(texture_width-1,texture_height-1);
+  }
+  bool is_dirty()
+  {
+    return needs_full_upload || (dirty_x1 < dirty_x2);
+  }
+  void clear_dirty_rect()
+  {
+    dirty_x1 = texture_width;
+    dirty_y1 = texture_height;
+    dirty_x2 = 0;
+    dirty_y2 = 0;
+  }
+  void putpixel(int x, int y, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+  {
+    mark_dirty(x,y);
+    data[4*(y*texture_width+x)] = r;
+    data[4*(y*texture_width+x)+1] = g;
+    data[4*(y*texture_width+x)+2] = b;
+    data[4*(y*texture_width+x)+3] = a;
+  }
+  tuple4<unsigned char> getpixel(int x, int y, unsigned char* raw_data = NULL)
+  {
+    if(raw_data == NULL)raw_data = this->data;
+    return make_tuple4<unsigned char>(raw_data[4*(y*texture_width+x)],raw_data[4*(y*texture_width+x)+1],raw_data[4*(y*texture_width+x)+2],raw_data[4*(y*texture_width+x)+3]);
+  }
+  void enforce_bounds(int& x, int& y)
+  {
+    if(x < 0)x = 0;
+    if(y < 0)y = 0;
+    if(x >= texture_width)x = texture_width-1;
+    if(y >= texture_height)y = texture_height-1;
+  }
+  void drawline(int x1, int y1, int x2, int y2, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+  {
+    //Bresenham's line drawing algorithm, translated from the wikipedia pseudocode
+    int dx = absolute(x2-x1);
+    int dy = absolute(y2-y1);
+    int sx = (x1<x2)?1:-1;
+    int sy = (y1<y2)?1:-1;
+    int err = dx-dy;
+    
+    int x = x1;
+    int y = y1;
+    for(;;)
+    {
+      //x and y are clamped to valid ranges with the mod (%) operator to facilitate drawing specific slants of lines:
+      //drawline(0,0,2*width,height,...) can be used instead of drawline(0,0,width,height/2,...)
+      putpixel(x%texture_width,y%texture_height,r,g,b,a);
+      //there were some glitches where the algorithm missed the destination by 1 pixel for some lines (reason unknown)
+      //and continued to the edge, so the break condition next line differs from the wikipedia version
+      if((absolute(x-x2)<2) && (absolute(y-y2)<2))break;
+      if((err*2) > -dy)
+      {
+        err -= dy;
+        x += sx;
+      }
+      if((err*2) < dx)
+      {
+        err += dx;
+        y += sy;
+      }
+    }
+    //following code fragment was taken from debugging code in main, first line works without my
+    //modification, 2nd line misses by 1px and would corrupt memory if not for the mod-clamping
+    /*texture_image tex;
+    tex.drawline(32,32,54,54,64,64,64,255);
+    tex.drawline(54,54,44,61,64,64,64,255);*/
+  }
+  //brings the mip chain up to date with the texels in [x1,x2) x [y1,y2), allocating it first if needed. each level only
+  //recomputes the texels over the changed ones of the level above, and records them in its dirty rect for the upload
+  void update_mipmaps(int x1, int y1, int x2, int y2)
+  {
+    if(mip_levels.empty())
+    {
+      int width = texture_width;
+      int height = texture_height;
+      while((width > 1 || height > 1) && (mip_level_limit < 0 || int(mip_levels.size()) < mip_level_limit))
+      {
+        mip_level level;
+        level.width = width = std::max(1,width/2);
+        level.height = height = std::max(1,height/2);
+        level.dirty_x1 = width;
+        level.dirty_y1 = height;
+        level.dirty_x2 = 0;
+        level.dirty_y2 = 0;
+        mip_levels.push_back(level);
+        mip_levels.back().texels.resize(4*width*height);
+      }
+      x1 = y1 = 0;
+      x2 = texture_width;
+      y2 = texture_height;
+    }
+    const unsigned char* source = data;
+    int source_width = texture_width;
+    int source_height = texture_height;
+    for(size_t c1=0;c1<mip_levels.size();c1++)
+    {
+      mip_level& level = mip_levels[c1];
+      x1 = x1/2;
+      y1 = y1/2;
+      x2 = std::min(level.width,(x2+1)/2);
+      y2 = std::min(level.height,(y2+1)/2);
+      for(int y=y1;y<y2;y++)
+      {
+        //a 1 pixel wide or high level just averages the 2 pixels it has
+        const unsigned char* row0 = source+4*size_t(std::min(2*y,source_height-1))*source_width;
+        const unsigned char* row1 = source+4*size_t(std::min(2*y+1,source_height-1))*source_width;
+        unsigned char* dest = &level.texels[4*size_t(y)*level.width];
+        if(source_width > 1)downsample_pixels(row0+8*x1,row1+8*x1,dest+4*x1,x2-x1);
+        else for(int c2=0;c2<4;c2++)dest[c2] = (unsigned char)((2*row0[c2]+2*row1[c2]+2) >> 2);
+      }
+      if(x1 < x2 && y1 < y2)
+      {
+        level.dirty_x1 = std::min(level.dirty_x1,x1);
+        level.dirty_y1 = std::min(level.dirty_y1,y1);
+        level.dirty_x2 = std::max(level.dirty_x2,x2);
+        level.dirty_y2 = std::max(level.dirty_y2,y2);
+      }
+      source = &level.texels[0];
+      source_width = level.width;
+      source_height = level.height;
+    }
+  }
+  //sends the dirty part of every mip level, or all of them when full is set
+  void upload_mipmaps(bool full)
+  {
+    for(size_t c1=0;c1<mip_levels.size();c1++)
+    {
+      mip_level& level = mip_levels[c1];
+      if(full)
+      {
+        glTexImage2D(GL_TEXTURE_2D,c1+1,4,level.width,level.height,0,GL_RGBA,GL_UNSIGNED_BYTE,&level.texels[0]);
+      }
+      else if(level.dirty_x1 < level.dirty_x2)
+      {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH,level.width);
+        glTexSubImage2D(GL_TEXTURE_2D,c1+1,level.dirty_x1,level.dirty_y1,level.dirty_x2-level.dirty_x1,level.dirty_y2-level.dirty_y1,
+                        GL_RGBA,GL_UNSIGNED_BYTE,&level.texels[4*(level.dirty_y1*level.width+level.dirty_x1)]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+      }
+    }
+    clear_mip_dirty_rects();
+  }
+  void clear_mip_dirty_rects()
+  {
+    for(size_t c1=0;c1<mip_levels.size();c1++)
+    {
+      mip_level& level = mip_levels[c1];
+      level.dirty_x1 = level.width;
+      level.dirty_y1 = level.height;
+      level.dirty_x2 = 0;
+      level.dirty_y2 = 0;
+    }
+  }
+  //binds the texture, only sending texels to the GPU if they changed since the last call: everything after creation or
+  //change_size, otherwise just the rectangle that putpixel touched (and what it covers in the mip levels)
+  void apply_texture()
+  {
+    glEnable(GL_TEXTURE_2D);
+    if(texture_id == 0)
+    {
+      glGenTextures(1,&texture_id);
+      needs_full_upload = true;
+    }
+    glBindTexture(GL_TEXTURE_2D,texture_id);
+    if(TEXTURE_MIPMAPS)
+    {
+      if(needs_full_upload)update_mipmaps(0,0,texture_width,texture_height);
+      else if(dirty_x1 < dirty_x2)update_mipmaps(dirty_x1,dirty_y1,dirty_x2,dirty_y2);
+    }
+    if(needs_full_upload)
+    {
+      //sampler state lives in the texture object, so it only has to be set once
+      glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,TEXTURE_MIPMAPS ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR); //GL_LINEAR or GL_NEAREST
+      glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+      glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_REPEAT);
+      glTexParameterf(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_REPEAT);
+      //a chain cut short by mip_level_limit is only complete with the levels past it switched off
+      if(TEXTURE_MIPMAPS)glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAX_LEVEL,mip_levels.size());
+      glTexImage2D(GL_TEXTURE_2D,0,4,texture_width,texture_height,0,GL_RGBA,GL_UNSIGNED_BYTE,data);
+      upload_mipmaps(true);
+      needs_full_upload = false;
+      pbo_pending = false; //older texels, and maybe another size
+    }
+    else if(streaming && gl_ext.have_pbo)
+    {
+      stream_texels();
+    }
+    else if(dirty_x1 < dirty_x2)
+    {
+      glPixelStorei(GL_UNPACK_ROW_LENGTH,texture_width);
+      glTexSubImage2D(GL_TEXTURE_2D,0,dirty_x1,dirty_y1,dirty_x2-dirty_x1,dirty_y2-dirty_y1,GL_RGBA,GL_UNSIGNED_BYTE,data+4*(dirty_y1*texture_width+dirty_x1));
+      glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+      upload_mipmaps(false);
+    }
+    clear_dirty_rect();
+  }
+  //each buffer holds level 0 followed by every mip level, so a frame's levels always reach the texture together
+  void stream_texels()
+  {
+    size_t level0_bytes = size_t(texture_width)*texture_height*4;
+    size_t bytes = level0_bytes;
+    for(size_t c1=0;c1<mip_levels.size();c1++)
+    {
+      bytes += mip_levels[c1].texels.size();
+    }
+    if(pbo_ids[0] == 0)gl_ext.gen_buffers(2,pbo_ids);
+    if(pbo_pending)
+    {
+      //filled on the previous bind, the copy into the texture is queued on the GPU and the call returns right away
+      gl_ext.bind_buffer(GL_PIXEL_UNPACK_BUFFER,pbo_ids[pbo_index]);
+      glTexSubImage2D(GL_TEXTURE_2D,0,0,0,texture_width,texture_height,GL_RGBA,GL_UNSIGNED_BYTE,NULL);
+      size_t offset = level0_bytes;
+      for(size_t c1=0;c1<mip_levels.size();c1++)
+      {
+        const mip_level& level = mip_levels[c1];
+        glTexSubImage2D(GL_TEXTURE_2D,c1+1,0,0,level.width,level.height,GL_RGBA,GL_UNSIGNED_BYTE,(const GLvoid*)offset);
+        offset += level.texels.size();
+      }
+      pbo_pending = false;
+    }
+    if(dirty_x1 < dirty_x2)
+    {
+      pbo_index = 1-pbo_index;
+      gl_ext.bind_buffer(GL_PIXEL_UNPACK_BUFFER,pbo_ids[pbo_index]);
+      //orphan the old storage first, so mapping doesn't have to wait for a transfer that might still be reading it
+      gl_ext.buffer_data(GL_PIXEL_UNPACK_BUFFER,bytes,NULL,GL_STREAM_DRAW);
+      unsigned char* mapped = (unsigned char*)gl_ext.map_buffer(GL_PIXEL_UNPACK_BUFFER,GL_WRITE_ONLY);
+      if(mapped != NULL)
+      {
+        memcpy(mapped,data,level0_bytes);
+        mapped += level0_bytes;
+        for(size_t c1=0;c1<mip_levels.size();c1++)
+        {
+          if(!mip_levels[c1].texels.empty())memcpy(mapped,&mip_levels[c1].texels[0],mip_levels[c1].texels.size());
+          mapped += mip_levels[c1].texels.size();
+        }
+        pbo_pending = (gl_ext.unmap_buffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE);
+      }
+      if(pbo_pending)
+      {
+        clear_mip_dirty_rects();
+      }
+      else
+      {
+        //mapping failed or the contents were lost, fall back to the direct upload
+        gl_ext.bind_buffer(GL_PIXEL_UNPACK_BUFFER,0);
+        glTexSubImage2D(GL_TEXTURE_2D,0,0,0,texture_width,texture_height,GL_RGBA,GL_UNSIGNED_BYTE,data);
+        upload_mipmaps(false);
+      }
+    }
+    gl_ext.bind_buffer(GL_PIXEL_UNPACK_BUFFER,0);
+  }
+  void save_texture(const char* fname)
+  {
+    FILE* f = fopen(fname,"wb");
+    if(f)
+    {
+      for(int c1=0;c1<texture_width*texture_height*4;c1+=4)
+      {
+        fprintf(f,"%c%c%c%c",data[c1],data[c1+1],data[c1+2],data[c1+3]);
+      }
+      fclose(f);
+    }
+  }
+#if EMBED_GIMP_TEXTURE
+  //the GNU Image Manipulation Program has the option to save images as raw data in a c source file, the following
+  //function uses those as textures, with the addition of "GIMP_IMAGE" to the struct type name in the generated file
+  void texture_from_gimp(const GIMP_IMAGE& image)
+  {
+    change_size(image.width,image.height);
+    memcpy(data,image.pixel_data,image.width*image.height*4);
+  }
+#endif
+  //loads a bmp, ppm or pam file (see parse_bmp and parse_netpbm for which kinds), resizing to fit it. the file is mapped
+  //rather than read, and each row converted straight from the mapping into data
+  bool texture_from_file(const char* path)
+  {
+    mapped_file file;
+    image_file_layout image;
+    if(!file.open(path))return false;
+    if(!parse_bmp(file.data,file.size,image) && !parse_netpbm(file.data,file.size,image))return false;
+    if(!change_size(image.width,image.height))return false;
+    for(int c1=0;c1<image.height;c1++)
+    {
+      convert_pixels(image.top_row+c1*image.row_stride,data+4*size_t(c1)*image.width,image.width,image.layout);
+    }
+    return true;
+  }
+  unsigned int texture_id;
+  unsigned char* data;
+  int texture_width;
+  int texture_height;
+  bool needs_full_upload;
+  bool streaming;
+  unsigned int pbo_ids[2];
+  int pbo_index; //the buffer written most recently
+  bool pbo_pending; //pbo_ids[pbo_index] has texels the texture hasn't received yet
+  //texels in [dirty_x1,dirty_x2) x [dirty_y1,dirty_y2) changed since the last upload
+  int dirty_x1;
+  int dirty_y1;
+  int dirty_x2;
+  int dirty_y2;
+  //levels 1 and up of the mip chain (data is level 0), each half the size of the one before down to 1x1
+  struct mip_level
+  {
+    int width;
+    int height;
+    std::vector<unsigned char> texels;
+    int dirty_x1; //what update_mipmaps changed since the last upload, like the texture's own dirty rect
+    int dirty_y1;
+    int dirty_x2;
+    int dirty_y2;
+  };
+  std::vector<mip_level> mip_levels;
+  int mip_level_limit; //how many levels past level 0 to keep, -1 for all of them
+};
+
+//packs the uvmaps of textured objects into a few shared pages, so drawing them all binds one texture instead of one each.
+//a uvmap keeps its own texels (it's drawn into exactly as before), update copies what changed to its place on its page,
+//and apply_texcoord_transform maps the object's texcoords there with the texture matrix, so no vertex data changes.
+//every uvmap is surrounded by a gutter of its own texels wrapped around, which keeps GL_REPEAT's filtering across the
+//edges, and pages only keep the mip levels the gutter still covers so the neighbours never bleed in. a lone uvmap saves
+//no binds and would lose its far mip levels, so the atlas only takes effect from two on
+class texture_atlas
+{
+  public:
+  texture_atlas(int page_size) : page_size(page_size), needs_repack(false) {}
+  ~texture_atlas()
+  {
+    clear_pages();
+  }
+  //starts keeping image in the atlas, if it isn't already
+  void add(texture_image* image)
+  {
+    if(entries.count(image))return;
+    entry& added = entries[image];
+    added.page = -1;
+  }
+  void remove(texture_image* image)
+  {
+    //the space stays taken until the next repack
+    entries.erase(image);
+  }
+  //places new uvmaps, repacks everything when one changed size (or a page ran out of room) and copies changed texels
+  void update()
+  {
+    if(entries.size() < 2)
+    {
+      //back to its own texture, which missed every change the atlas took
+      for(std::map<texture_image*,entry>::iterator c1=entries.begin();c1!=entries.end();c1++)
+      {
+        if(c1->second.page >= 0)c1->first->needs_full_upload = true;
+        c1->second.page = -1;
+      }
+      clear_pages();
+      return;
+    }
+    for(std::map<texture_image*,entry>::iterator c1=entries.begin();c1!=entries.end();c1++)
+    {
+      const entry& e = c1->second;
+      if(e.page >= 0 && (e.width != c1->first->texture_width || e.height != c1->first->texture_height))needs_repack = true;
+    }
+    if(needs_repack)repack();
+    for(std::map<texture_image*,entry>::iterator c1=entries.begin();c1!=entries.end();c1++)
+    {
+      if(c1->second.page < 0 && !place(c1->first,c1->second))
+      {
+        //out of room: packing everything again from scratch reclaims the space of removed uvmaps, and adds pages as needed
+        repack();
+        break;
+      }
+    }
+    for(std::map<texture_image*,entry>::iterator c1=entries.begin();c1!=entries.end();c1++)
+    {
+      copy_texels(c1->first,c1->second);
+    }
+  }
+  //the page image is on, NULL if it isn't in the atlas (or update hasn't run since it was added, or it's the only uvmap)
+  texture_image* page_of(texture_image* image)
+  {
+    std::map<texture_image*,entry>::iterator found = entries.find(image);
+    if(found == entries.end() || found->second.page < 0)return NULL;
+    return pages[found->second.page].texture;
+  }
+  //multiplies the current (texture) matrix by the mapping from image's [0,1] texcoords to its rectangle on its page
+  void apply_texcoord_transform(texture_image* image)
+  {
+    std::map<texture_image*,entry>::iterator found = entries.find(image);
+    if(found == entries.end() || found->second.page < 0)return;
+    const entry& e = found->second;
+    const texture_image* texture = pages[e.page].texture;
+    glTranslatef(float(e.x)/texture->texture_width,float(e.y)/texture->texture_height,0);
+    glScalef(float(e.width)/texture->texture_width,float(e.height)/texture->texture_height,1);
+  }
+  size_t page_count()
+  {
+    return pages.size();
+  }
+  
+  private:
+  //texels around each uvmap, the grid their rectangles start on, and the mip levels past level 0 a page keeps: at level
+  //3 the gutter is down to one texel, past that filtering would reach the neighbours
+  enum {GUTTER = 8, ALIGNMENT = 8, MIP_LEVELS = 3};
+  struct entry
+  {
+    int page;
+    int x; //where the uvmap's own texels start, inside the gutter
+    int y;
+    int width; //the uvmap's size when it was placed
+    int height;
+  };
+  //skyline packer: the top edge of everything placed so far, as segments from left to right covering the page's width
+  struct skyline_segment
+  {
+    int x;
+    int y;
+    int width;
+  };
+  struct page
+  {
+    texture_image* texture;
+    std::vector<skyline_segment> skyline;
+  };
+  static int aligned(int value)
+  {
+    return (value+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+  }
+  //bottom-left: the lowest spot (then the leftmost) where a width x height rectangle rests on the skyline
+  static bool skyline_place(page& target, int width, int height, int& out_x, int& out_y)
+  {
+    std::vector<skyline_segment>& skyline = target.skyline;
+    int best = -1;
+    int best_y = 0;
+    for(size_t c1=0;c1<skyline.size();c1++)
+    {
+      int x = skyline[c1].x;
+      if(x+width > target.texture->texture_width)break;
+      int y = 0;
+      for(size_t c2=c1;c2<skyline.size() && skyline[c2].x < x+width;c2++)
+      {
+        y = std::max(y,skyline[c2].y);
+      }
+      if(y+height <= target.texture->texture_height && (best < 0 || y < best_y))
+      {
+        best = int(c1);
+        best_y = y;
+      }
+    }
+    if(best < 0)return false;
+    out_x = skyline[best].x;
+    out_y = best_y;
+    //the new segment replaces whatever it covers, the last covered one is cut to what sticks out to the right
+    skyline_segment added = {out_x,out_y+height,width};
+    size_t end = best;
+    while(end < skyline.size() && skyline[end].x+skyline[end].width <= out_x+width)end++;
+    if(end < skyline.size() && skyline[end].x < out_x+width)
+    {
+      skyline[end].width -= out_x+width-skyline[end].x;
+      skyline[end].x = out_x+width;
+    }
+    skyline.erase(skyline.begin()+best,skyline.begin()+end);
+    skyline.insert(skyline.begin()+best,added);
+    //neighbours at the same height become one segment
+    for(size_t c1=1;c1<skyline.size();)
+    {
+      if(skyline[c1-1].y == skyline[c1].y)
+      {
+        skyline[c1-1].width += skyline[c1].width;
+        skyline.erase(skyline.begin()+c1);
+      }
+      else c1++;
+    }
+    return true;
+  }
+  void add_page(int size)
+  {
+    page added;
+    added.texture = new texture_image;
+    added.texture->mip_level_limit = MIP_LEVELS;
+    added.texture->change_size(size,size);
+    memset(added.texture->data,0,size_t(size)*size*4);
+    skyline_segment floor = {0,0,size};
+    added.skyline.push_back(floor);
+    pages.push_back(added);
+  }
+  void clear_pages()
+  {
+    for(size_t c1=0;c1<pages.size();c1++)
+    {
+      delete pages[c1].texture;
+    }
+    pages.clear();
+  }
+  //finds room on an existing page, or on a new one when placing everything from scratch (allow_new_page)
+  bool place(texture_image* image, entry& e, bool allow_new_page = false)
+  {
+    int width = aligned(image->texture_width+2*GUTTER);
+    int height = aligned(image->texture_height+2*GUTTER);
+    int x = 0;
+    int y = 0;
+    size_t c1 = 0;
+    for(;c1<pages.size();c1++)
+    {
+      if(skyline_place(pages[c1],width,height,x,y))break;
+    }
+    if(c1 == pages.size())
+    {
+      if(!allow_new_page)return false;
+      //uvmaps bigger than a page get one of their own, a power of two so the mip chain halves evenly
+      int size = page_size;
+      while(size < std::max(width,height))size *= 2;
+      add_page(size);
+      skyline_place(pages.back(),width,height,x,y);
+    }
+    e.page = int(c1);
+    e.x = x+GUTTER;
+    e.y = y+GUTTER;
+    e.width = image->texture_width;
+    e.height = image->texture_height;
+    image->needs_full_upload = true; //so copy_texels sends all of it
+    //a uvmap redrawn every frame makes its page one too
+    if(image->streaming)pages[c1].texture->enable_streaming();
+    return true;
+  }
+  static bool taller(const std::pair<int,texture_image*>& a, const std::pair<int,texture_image*>& b)
+  {
+    return a.first > b.first;
+  }
+  //places every uvmap again on fresh pages, tallest first, which packs a skyline best
+  void repack()
+  {
+    clear_pages();
+    std::vector<std::pair<int,texture_image*> > order;
+    for(std::map<texture_image*,entry>::iterator c1=entries.begin();c1!=entries.end();c1++)
+    {
+      order.push_back(std::make_pair(c1->first->texture_height,c1->first));
+    }
+    std::stable_sort(order.begin(),order.end(),taller);
+    for(size_t c1=0;c1<order.size();c1++)
+    {
+      place(order[c1].second,entries[order[c1].second],true);
+    }
+    needs_repack = false;
+  }
+  //copies image's changed texels to its page, then leaves its dirty state cleared since the page is what gets uploaded
+  void copy_texels(texture_image* image, const entry& e)
+  {
+    if(e.page < 0 || !image->is_dirty())return;
+    texture_image* texture = pages[e.page].texture;
+    int x1 = 0;
+    int y1 = 0;
+    int x2 = e.width;
+    int y2 = e.height;
+    if(!image->needs_full_upload)
+    {
+      x1 = image->dirty_x1;
+      y1 = image->dirty_y1;
+      x2 = image->dirty_x2;
+      y2 = image->dirty_y2;
+    }
+    for(int y=y1;y<y2;y++)
+    {
+      memcpy(texture->data+4*(size_t(e.y+y)*texture->texture_width+e.x+x1),image->data+4*(size_t(y)*e.width+x1),4*(x2-x1));
+    }
+    texture->mark_dirty(e.x+x1,e.y+y1);
+    texture->mark_dirty(e.x+x2-1,e.y+y2-1);
+    if(x1 < GUTTER || y1 < GUTTER || x2 > e.width-GUTTER || y2 > e.height-GUTTER)copy_gutter(image,e,texture);
+    image->needs_full_upload = false;
+    image->clear_dirty_rect();
+  }
+  //the texels around the uvmap, taken from the opposite edges as GL_REPEAT would
+  void copy_gutter(texture_image* image, const entry& e, texture_image* texture)
+  {
+    for(int y=-GUTTER;y<e.height+GUTTER;y++)
+    {
+      bool inside_row = (y >= 0 && y < e.height);
+      for(int x=-GUTTER;x<e.width+GUTTER;x++)
+      {
+        if(inside_row && x == 0)x = e.width; //the uvmap itself is already there
+        int source_x = ((x%e.width)+e.width)%e.width;
+        int source_y = ((y%e.height)+e.height)%e.height;
+        memcpy(texture->data+4*(size_t(e.y+y)*texture->texture_width+e.x+x),image->data+4*(size_t(source_y)*e.width+source_x),4);
+      }
+    }
+    texture->mark_dirty(e.x-GUTTER,e.y-GUTTER);
+    texture->mark_dirty(e.x+e.width+GUTTER-1,e.y+e.height+GUTTER-1);
+  }
+  int page_size;
+  bool needs_repack;
+  std::vector<page> pages;
+  std::map<texture_image*,entry> entries;
+};
+
+texture_atlas uvmap_atlas(ATLAS_PAGE_SIZE);
+
+void remove_from_atlas(texture_image* image)
+{
+  uvmap_atlas.remove(image);
+}
+
+//spheres that are only ever seen from far enough away to be drawn as flat discs facing the camera, so only their
+//centers are stored (12 bytes per dot rather than a mesh)
+class dot_cloud
+{
+  public:
+  std::vector<tuple3<float> > centers;
+  float radius;
+  tuple4<float> color;
+  std::vector<float> impostor_vertices; //scratch for drawing without point sprites
+};
+
+//a curve thin enough to be drawn as a line strip through its sample points, width is in object space units
+//and converted to pixels for the distance it's seen from
+class polyline
+{
+  public:
+  std::vector<tuple3<float> > points;
+  float width;
+  tuple4<float> color;
+};
+
+//one placement of an instanced object's mesh, relative to the object's own position and rotation
+//instances are culled and drawn in runs of up to this many that are close together, see object3d::update_instance_chunks
+#define INSTANCE_CHUNK_SIZE 256
+
+struct instance_type
+{
+  tuple3<float> position;
+  tuple3<float> rotation;
+  tuple3<float> scale;
+  tuple4<float> color; //replaces the mesh's vertex colors, unless its alpha is 0
+};
+
+instance_type make_instance(const tuple3<float>& position, const tuple3<float>& rotation, const tuple3<float>& scale, const tuple4<float>& color)
+{
+  instance_type tmp;
+  tmp.position = position;
+  tmp.rotation = rotation;
+  tmp.scale = scale;
+  tmp.color = color;
+  return tmp;
+}
+
+class object3d
+{
+  public:
+  object3d()
+  {
+    position = make_tuple3<float>(0,0,0);
+    rotation = make_tuple3<float>(0,0,0);
+    use_uvmap = false;
+    uvmap = NULL;
+    visible = true;
+    geometry_dirty = true;
+    bounds_dirty = true;
+    indexed = NULL;
+    compact = NULL;
+    instance_spin = make_tuple3<float>(0,0,0);
+    instances_dirty = true;
+    instance_buffer_id = 0;
+    instance_buffer_dirty = true;
+    bvh_item = -1;
+    bvh_moved = NULL;
+    bvh_refit_pending = false;
+    dots = NULL;
+    line = NULL;
+  }
+  //from the current arena when there is one, see arena_scope
+  static void* operator new(size_t size)
+  {
+    return scene_allocate(size,current_arena);
+  }
+  static void operator delete(void* p)
+  {
+    scene_deallocate(p);
+  }
+  ~object3d()
+  {
+    if(instance_buffer_id != 0 && gl_ext.have_vbo)gl_ext.delete_buffers(1,&instance_buffer_id);
+    if(uvmap != NULL)delete uvmap;
+    if(indexed != NULL)delete indexed;
+    if(compact != NULL)delete compact;
+    if(dots != NULL)delete dots;
+    if(line != NULL)delete line;
+  }
+  void initialize_uvmap()
+  {
+    if(uvmap != NULL)delete uvmap;
+    uvmap = new texture_image;
+  }
+  //call after modifying triangles in place, so the copy on the GPU gets refreshed on the next draw
+  void geometry_changed()
+  {
+    geometry_dirty = true;
+    bounds_dirty = true;
+    moved();
+  }
+  //call after adding, removing or changing instances. animating instance_spin needs none of this
+  void instances_changed()
+  {
+    bounds_dirty = true;
+    instances_dirty = true;
+    moved();
+  }
+  //call after changing position, so the scene_bvh holding the object refits around it on its next sync. rotating
+  //doesn't need it, the hierarchy's bounds allow for any rotation
+  void moved()
+  {
+    if(bvh_moved == NULL || bvh_refit_pending)return;
+    bvh_moved->push_back(this);
+    bvh_refit_pending = true;
+  }
+  mat4 instance_matrix(size_t index)
+  {
+    const instance_type& inst = instances[index];
+    return mat4::from_mat3(mat3::from_rotation(instance_spin)*mat3::from_rotation(inst.rotation),inst.position)*mat4::scaling(inst.scale);
+  }
+  //sorts the instances into chunks of up to INSTANCE_CHUNK_SIZE that are close together, each one a contiguous range of
+  //instances with a bounding sphere, and packs their transforms into instance_data. only does something after
+  //instances_changed, so a scene whose instances just spin culls chunks and reuses the buffer already on the GPU
+  void update_instance_chunks()
+  {
+    if(!instances_dirty)return;
+    update_bounds();
+    instances_dirty = false;
+    instance_buffer_dirty = true;
+    instance_chunks.clear();
+    instance_data.clear();
+    if(instances.empty())return;
+    build_instance_chunks(0,instances.size());
+    instance_data.reserve(16*instances.size());
+    for(size_t c1=0;c1<instances.size();c1++)
+    {
+      const instance_type& inst = instances[c1];
+      mat4 instance = mat4::from_rotation_translation(inst.rotation,inst.position)*mat4::scaling(inst.scale);
+      //three rows of the matrix and the color
+      for(int row=0;row<3;row++)
+      {
+        for(int col=0;col<4;col++)
+        {
+          instance_data.push_back(instance.m[col*4+row]);
+        }
+      }
+      instance_data.push_back(inst.color.w);
+      instance_data.push_back(inst.color.x);
+      instance_data.push_back(inst.color.y);
+      instance_data.push_back(inst.color.z);
+    }
+  }
+  struct instance_position_less
+  {
+    int axis;
+    bool operator()(const instance_type& a, const instance_type& b) const
+    {
+      if(axis == 0)return a.position.x < b.position.x;
+      if(axis == 1)return a.position.y < b.position.y;
+      return a.position.z < b.position.z;
+    }
+  };
+  //median splits along the most spread out axis, like scene_bvh::build_node
+  void build_instance_chunks(size_t first, size_t count)
+  {
+    if(count <= INSTANCE_CHUNK_SIZE)
+    {
+      instance_chunk chunk;
+      chunk.first = first;
+      chunk.count = count;
+      bound_instances(first,count,chunk.center,chunk.radius);
+      instance_chunks.push_back(chunk);
+      return;
+    }
+    tuple3<float> low = instances[first].position;
+    tuple3<float> high = low;
+    for(size_t c1=first+1;c1<first+count;c1++)
+    {
+      const tuple3<float>& p = instances[c1].position;
+      low = make_tuple3(std::min(low.x,p.x),std::min(low.y,p.y),std::min(low.z,p.z));
+      high = make_tuple3(std::max(high.x,p.x),std::max(high.y,p.y),std::max(high.z,p.z));
+    }
+    instance_position_less less;
+    less.axis = 0;
+    if(high.y-low.y > high.x-low.x)less.axis = 1;
+    if(high.z-low.z > std::max(high.x-low.x,high.y-low.y))less.axis = 2;
+    size_t middle = first+count/2;
+    std::nth_element(instances.begin()+first,instances.begin()+middle,instances.begin()+first+count,less);
+    build_instance_chunks(first,middle-first);
+    build_instance_chunks(middle,first+count-middle);
+  }
+  static float largest_scale(const instance_type& inst)
+  {
+    return std::max(absolute(inst.scale.x),std::max(absolute(inst.scale.y),absolute(inst.scale.z)));
+  }
+  //re-encodes the triangles in the compact format and frees the float copy, the renderer then uses the compact one directly.
+  //uvmap outlines are drawn from the triangles' texcoords, so do that first for textured objects
+  void compact_geometry(bool quantize_positions)
+  {
+    if(dots != NULL || line != NULL)return;
+    if(compact == NULL)compact = new compact_mesh;
+    if(indexed != NULL)
+    {
+      compact->encode(indexed->vertices.empty() ? NULL : &indexed->vertices[0],indexed->vertices.size(),quantize_positions);
+      compact->indices.swap(indexed->indices);
+      delete indexed;
+      indexed = NULL;
+    }
+    else
+    {
+      compact->encode(triangles.empty() ? NULL : triangles[0].verts,triangles.size()*3,quantize_positions);
+      compact->indices.clear();
+    }
+    triangle_list().swap(triangles);
+    geometry_changed();
+  }
+  //converts triangles into an indexed mesh with duplicate vertices merged
+  void weld_geometry()
+  {
+    if(compact != NULL || triangles.empty())return;
+    if(indexed == NULL)indexed = new indexed_mesh;
+    indexed->weld(triangles);
+    triangle_list().swap(triangles);
+    geometry_changed();
+  }
+  vertex_source get_vertex_source()
+  {
+    static const std::vector<unsigned int> no_indices;
+    if(dots != NULL)return make_vertex_source(dots->centers.empty() ? NULL : &dots->centers[0],dots->centers.size(),point_vertex_layout(),no_indices);
+    if(line != NULL)return make_vertex_source(line->points.empty() ? NULL : &line->points[0],line->points.size(),point_vertex_layout(),no_indices);
+    if(compact != NULL)return make_vertex_source(compact->data.empty() ? NULL : &compact->data[0],compact->count,compact->get_layout(),compact->indices);
+    if(indexed != NULL)return make_vertex_source(indexed->vertices.empty() ? NULL : &indexed->vertices[0],indexed->vertices.size(),float_vertex_layout(),indexed->indices);
+    return make_vertex_source(triangles.empty() ? NULL : triangles[0].verts,triangles.size()*3,float_vertex_layout(),no_indices);
+  }
+  //triangle access that works whichever representation the geometry is in
+  size_t triangle_count()
+  {
+    if(dots != NULL || line != NULL)return 0;
+    if(compact != NULL)return (compact->indices.empty() ? compact->count : compact->indices.size())/3;
+    if(indexed != NULL)return indexed->indices.size()/3;
+    return triangles.size();
+  }
+  vertex_type triangle_vertex(size_t triangle, int corner)
+  {
+    size_t index = triangle*3+corner;
+    if(compact != NULL)return compact->vertex(compact->indices.empty() ? index : compact->indices[index]);
+    if(indexed != NULL)return indexed->vertices[indexed->indices[index]];
+    return triangles[triangle].verts[corner];
+  }
+  //every distinct vertex position, whichever representation the geometry is in
+  size_t position_count()
+  {
+    if(dots != NULL)return dots->centers.size();
+    if(line != NULL)return line->points.size();
+    if(compact != NULL)return compact->count;
+    if(indexed != NULL)return indexed->vertices.size();
+    return triangles.size()*3;
+  }
+  tuple3<float> vertex_position(size_t index)
+  {
+    if(dots != NULL)return dots->centers[index];
+    if(line != NULL)return line->points[index];
+    if(compact != NULL)return compact->position(index);
+    if(indexed != NULL)return indexed->vertices[index].pos;
+    return triangles[index/3].verts[index%3].pos;
+  }
+  //bounding sphere in object space (before rotation and position are applied), recomputed lazily after the geometry changes.
+  //with instances, prototype_center/radius bound the mesh and bounds_center/radius all the instances
+  void update_bounds()
+  {
+    size_t count = position_count();
+    if(!bounds_dirty && bounds_position_count == count)return;
+    bounds_dirty = false;
+    bounds_position_count = count;
+    update_mesh_bounds(count);
+    prototype_center = bounds_center;
+    prototype_radius = bounds_radius;
+    if(!instances.empty())update_instance_bounds();
+  }
+  void update_mesh_bounds(size_t count)
+  {
+    bounds_center = make_tuple3<float>(0,0,0);
+    bounds_radius = 0;
+    if(count == 0)return;
+    tuple3<float> low = vertex_position(0);
+    tuple3<float> high = low;
+    for(size_t c1=1;c1<count;c1++)
+    {
+      tuple3<float> p = vertex_position(c1);
+      low = make_tuple3(std::min(low.x,p.x),std::min(low.y,p.y),std::min(low.z,p.z));
+      high = make_tuple3(std::max(high.x,p.x),std::max(high.y,p.y),std::max(high.z,p.z));
+    }
+    bounds_center = make_tuple3((low.x+high.x)/2,(low.y+high.y)/2,(low.z+high.z)/2);
+    float radius_squared = 0;
+    for(size_t c1=0;c1<count;c1++)
+    {
+      tuple3<float> d = vertex_position(c1) - bounds_center;
+      radius_squared = std::max(radius_squared,d.x*d.x + d.y*d.y + d.z*d.z);
+    }
+    bounds_radius = sqrt(radius_squared);
+    if(dots != NULL)bounds_radius += dots->radius;
+    if(line != NULL)bounds_radius += line->width/2;
+  }
+  void update_instance_bounds()
+  {
+    bound_instances(0,instances.size(),bounds_center,bounds_radius);
+  }
+  //sphere around instances [first,first+count), each one bounded around its position at any rotation, like scene_bvh
+  //does with whole objects
+  void bound_instances(size_t first, size_t count, tuple3<float>& center, float& radius)
+  {
+    float reach = sqrt(prototype_center.x*prototype_center.x + prototype_center.y*prototype_center.y + prototype_center.z*prototype_center.z) + prototype_radius;
+    tuple3<float> low = instances[first].position;
+    tuple3<float> high = low;
+    for(size_t c1=first;c1<first+count;c1++)
+    {
+      const tuple3<float>& p = instances[c1].position;
+      float r = reach*largest_scale(instances[c1]);
+      low = make_tuple3(std::min(low.x,p.x-r),std::min(low.y,p.y-r),std::min(low.z,p.z-r));
+      high = make_tuple3(std::max(high.x,p.x+r),std::max(high.y,p.y+r),std::max(high.z,p.z+r));
+    }
+    center = make_tuple3((low.x+high.x)/2,(low.y+high.y)/2,(low.z+high.z)/2);
+    radius = 0;
+    for(size_t c1=first;c1<first+count;c1++)
+    {
+      const tuple3<float>& p = instances[c1].position;
+      tuple3<float> d = make_tuple3(p.x-center.x,p.y-center.y,p.z-center.z);
+      radius = std::max(radius,sqrt(d.x*d.x + d.y*d.y + d.z*d.z) + reach*largest_scale(instances[c1]));
+    }
+  }
+  void update_mesh_buffer()
+  {
+    vertex_source source = get_vertex_source();
+    if(geometry_dirty || mesh.vertex_count != source.vertex_count || mesh.index_count != source.index_count)
+    {
+      mesh.upload(source);
+      geometry_dirty = false;
+    }
+  }
+  void draw_uvmap_outline()
+  {
+    if(uvmap == NULL)
+    {
+      initialize_uvmap();
+    }
+    random_stream& random = thread_random();
+    
+    for(int y=0;y<uvmap->texture_height;y++)
+    {
+      for(int x=0;x<uvmap->texture_width;x++)
+      {
+        int lum = random.next_int(32)+32;
+        uvmap->putpixel(x,y,lum,lum,lum,255);
+      }
+    }
+    if(GENERATE_TIKZ_OUTPUT)printf("\\begin{tikzpicture}\n");
+    for(int c1=0;c1<triangle_count();c1++)
+    {
+      for(int c2=0;c2<3;c2++)
+      {
+        tuple2<float> uv1 = triangle_vertex(c1,c2).texcoords;
+        tuple2<float> uv2 = triangle_vertex(c1,(c2+1)%3).texcoords;
+        int x1 = uv1.x*uvmap->texture_width;
+        int y1 = uv1.y*uvmap->texture_height;
+        int x2 = uv2.x*uvmap->texture_width;
+        int y2 = uv2.y*uvmap->texture_height;
+        if(GENERATE_TIKZ_OUTPUT)printf("\\draw (%d,-%d) -- (%d,-%d);\n",x1,y1,x2,y2);
+        uvmap->drawline(x1,y1,x2,y2,random.next_int(127)+128,random.next_int(127)+128,random.next_int(127)+128,255);
+      }
+    }
+    if(GENERATE_TIKZ_OUTPUT)printf("\\end{tikzpicture}\n");
+  }
+  //stripe_offset scrolls the stripes sideways, by that many texels
+  void draw_uvmap_barberpole(int stripe_offset = 0)
+  {
+    if(uvmap == NULL)
+    {
+      initialize_uvmap();
+    }
+    //draw the end caps with lines to provide fixed points to view rotation
+    draw_uvmap_outline();
+    //overwrite the sides
+    for(int y=uvmap->texture_height/2;y<uvmap->texture_height;y++)
+    {
+      for(int x=0;x<uvmap->texture_width;x++)
+      {
+        uvmap->putpixel(x,y,0,0,0,255);
       }
     }
     for(int c1=0;c1<uvmap->texture_width/4;c1++)
     {
-      uvmap->drawline(c1,127,c1+uvmap->texture_width/2,64,0,0,255,255);
-      uvmap->drawline(c1+uvmap->texture_width/2,127,c1+2*uvmap->texture_width/2,64,255,0,0,255);
+      int x = c1+stripe_offset;
+      uvmap->drawline(x,127,x+uvmap->texture_width/2,64,0,0,255,255);
+      uvmap->drawline(x+uvmap->texture_width/2,127,x+2*uvmap->texture_width/2,64,255,0,0,255);
+    }
+    for(int c1=0;c1<1;c1++)
+    {
+      uvmap->drawline(0,127-c1,uvmap->texture_width,127-c1,255,255,255,255);
+      uvmap->drawline(0,64+c1,uvmap->texture_width,64+c1,255,255,255,255);
+    }
+  }
+  bool visible;
+  bool use_uvmap;
+  texture_image* uvmap;
+  tuple3<float> position;
+  tuple3<float> rotation;
+  triangle_list triangles;
+  bool geometry_dirty;
+  bool bounds_dirty;
+  size_t bounds_position_count;
+  tuple3<float> bounds_center;
+  float bounds_radius;
+  tuple3<float> prototype_center;
+  float prototype_radius;
+  //when not empty, the geometry is drawn once per instance instead of once at position/rotation,
+  //so memory and draw calls grow with the number of distinct meshes rather than the number of copies
+  std::vector<instance_type> instances;
+  //added to every instance's rotation, on the outside (about its position, after its own rotation), so animating it
+  //leaves the per-instance data alone
+  tuple3<float> instance_spin;
+  struct instance_chunk
+  {
+    size_t first;
+    size_t count;
+    tuple3<float> center;
+    float radius;
+  };
+  std::vector<instance_chunk> instance_chunks;
+  bool instances_dirty; //instance_chunks and instance_data need rebuilding
+  std::vector<float> instance_data; //16 floats per instance, the top three rows of its transform then its color (rgba)
+  unsigned int instance_buffer_id; //instance_data for the shader path, uploaded again only when it changed
+  bool instance_buffer_dirty;
+  int bvh_item; //where the scene_bvh holding the object keeps it, -1 when none does
+  std::vector<object3d*>* bvh_moved; //that hierarchy's list of objects to refit, which moved() adds to
+  bool bvh_refit_pending; //already on that list
+  //at most one of these holds the geometry at a time: triangles as generated, indexed after weld_geometry,
+  //compact after compact_geometry
+  indexed_mesh* indexed;
+  compact_mesh* compact;
+  dot_cloud* dots; //when set, the object is drawn as these dots and has no triangles
+  polyline* line; //same for a line strip
+  mesh_buffer mesh;
+};
+
+//cos and sin of segments equal steps, computed once per segment count and shared by every generator asking for that count.
+//circle_* are 2*PI*c1/segments the way the ngon generators compute them, longitude_* the same angles rounded to float first
+//and latitude_* PI*c1/segments (pole to pole) the way generate_sphereoid computes them. every table has segments+1 entries,
+//so step c1+1 never needs wrapping
+class trig_table
+{
+  public:
+  trig_table(unsigned int count) : segments(count), circle_cos(count+1), circle_sin(count+1),
+    longitude_cos(count+1), longitude_sin(count+1), latitude_cos(count+1), latitude_sin(count+1)
+  {
+    for(unsigned int c1=0;c1<=segments;c1++)
+    {
+      circle_cos[c1] = cos(2*PI*c1/segments);
+      circle_sin[c1] = sin(2*PI*c1/segments);
+      float theta = 2*PI*float(c1)/segments;
+      longitude_cos[c1] = cos(theta);
+      longitude_sin[c1] = sin(theta);
+      float y_seg = PI*float(c1)/segments;
+      latitude_cos[c1] = cos(y_seg);
+      latitude_sin[c1] = sin(y_seg);
+    }
+  }
+  unsigned int segments;
+  std::vector<double> circle_cos;
+  std::vector<double> circle_sin;
+  std::vector<float> longitude_cos;
+  std::vector<float> longitude_sin;
+  std::vector<float> latitude_cos;
+  std::vector<float> latitude_sin;
+};
+
+//the counts the scene asks for most (axes, planes, spiral dots and tubes) are built before main and read without locking
+template<unsigned int N> struct fixed_trig_table
+{
+  static const trig_table table;
+};
+template<unsigned int N> const trig_table fixed_trig_table<N>::table(N);
+
+mutex_type trig_table_lock;
+std::map<unsigned int,trig_table*> trig_tables;
+
+const trig_table& get_trig_table(unsigned int segments)
+{
+  switch(segments)
+  {
+    case 2: return fixed_trig_table<2>::table;
+    case 3: return fixed_trig_table<3>::table;
+    case 4: return fixed_trig_table<4>::table;
+    case 16: return fixed_trig_table<16>::table;
+  }
+  scoped_lock hold(trig_table_lock);
+  trig_table*& table = trig_tables[segments];
+  if(!table)table = new trig_table(segments);
+  return *table;
+}
+
+//identifies a generated mesh by its generator's name and parameters: the bytes are kept so a lookup can't be fooled by a hash
+//collision, the hash (64 bit fnv-1a) is what the cache is indexed by
+class mesh_key
+{
+  public:
+  mesh_key(const char* generator = "") : hash(0xcbf29ce484222325ULL), length(0), overflow(false)
+  {
+    memset(bytes,0,sizeof(bytes));
+    add(generator,strlen(generator)+1);
+  }
+  template<class T> mesh_key& operator<<(const T& value)
+  {
+    add(&value,sizeof(T));
+    return *this;
+  }
+  void add(const void* data, size_t size)
+  {
+    if(length+size > sizeof(bytes))
+    {
+      overflow = true;
+      return;
+    }
+    const unsigned char* source = (const unsigned char*)data;
+    for(size_t c1=0;c1<size;c1++)
+    {
+      bytes[length++] = source[c1];
+      hash = (hash ^ source[c1])*0x100000001b3ULL;
+    }
+  }
+  bool operator==(const mesh_key& other) const
+  {
+    return length == other.length && memcmp(bytes,other.bytes,length) == 0;
+  }
+  uint64_t hash;
+  unsigned char bytes[96];
+  size_t length;
+  bool overflow; //parameters didn't fit, never cached
+};
+
+//tubes and sphereoids the generators have already built, so asking for the same one again costs a lookup and a copy. these
+//are the shapes tube and dotted spirals are swept from, so with THIN_SPIRALS_AS_LINES and DOTTED_SPIRAL_AS_POINTS on (spirals
+//drawn as a line strip and a point cloud) nothing is looked up. entries never change once stored; a hit copies the triangles
+//into the caller's object since object3d owns its geometry and the prepare step welds or compacts it right after generation,
+//so the copy a copy-on-write handle would make on the first write is made up front. only meshes that don't depend on the
+//random stream (a single color) belong here
+class mesh_cache
+{
+  public:
+  mesh_cache(size_t byte_limit) : byte_limit(byte_limit), bytes(0), hits(0), misses(0) {}
+  ~mesh_cache()
+  {
+    clear();
+  }
+  template<class List> bool lookup(const mesh_key& key, List& out)
+  {
+    scoped_lock hold(lock);
+    std::map<uint64_t,entry*>::iterator found = entries.find(key.hash);
+    if(key.overflow || found == entries.end() || !(found->second->key == key))
+    {
+      misses++;
+      return false;
+    }
+    hits++;
+    out.assign(found->second->triangles.begin(),found->second->triangles.end());
+    return true;
+  }
+  template<class List> void store(const mesh_key& key, const List& triangles)
+  {
+    if(key.overflow)return;
+    scoped_lock hold(lock);
+    size_t size = triangles.size()*sizeof(triangle_type);
+    if(size > byte_limit || entries.count(key.hash))return;
+    //a moving object regenerated every frame would otherwise grow the cache forever
+    if(bytes+size > byte_limit)clear_locked();
+    entry* stored = new entry(key);
+    stored->triangles.assign(triangles.begin(),triangles.end());
+    entries[key.hash] = stored;
+    bytes += size;
+  }
+  void clear()
+  {
+    scoped_lock hold(lock);
+    clear_locked();
+  }
+  size_t byte_limit;
+  size_t bytes;
+  unsigned long hits;
+  unsigned long misses;
+  
+  private:
+  struct entry
+  {
+    entry(const mesh_key& key) : key(key) {}
+    mesh_key key;
+    std::vector<triangle_type> triangles;
+  };
+  void clear_locked()
+  {
+    for(std::map<uint64_t,entry*>::iterator c1=entries.begin();c1!=entries.end();c1++)
+    {
+      delete c1->second;
+    }
+    entries.clear();
+    bytes = 0;
+  }
+  std::map<uint64_t,entry*> entries;
+  mutex_type lock;
+};
+
+mesh_cache generated_meshes(8<<20);
+
+//generated geometry and texels kept between runs. a record is found by its mesh_key, which for anything that draws random
+//numbers includes the seed and the calling thread's stream position (see seeded_key), and also holds where that stream was
+//left afterwards, so a hit leaves the program in exactly the state generating would have. the file is mapped on open and
+//records are copied straight out of the mapping; new records are kept in memory until save writes everything back
+class disk_cache
+{
+  public:
+  disk_cache() : enabled(false), added_bytes(0) {}
+  ~disk_cache()
+  {
+    discard_added();
+  }
+  //starts using path, whatever's in it (if it's a cache this build can read) is available to lookup
+  void open(const char* path)
+  {
+    enabled = true;
+    file_path = path;
+    records.clear();
+    if(!file.open(path))return;
+    const file_header* header = (const file_header*)file.data;
+    if(file.size < sizeof(file_header) || memcmp(header->magic,"CPDCACHE",8) != 0 || header->version != VERSION ||
+       header->triangle_size != sizeof(triangle_type) || header->record_size != sizeof(record) || header->record_count > (file.size-sizeof(file_header))/sizeof(record))
+    {
+      file.close();
+      return;
+    }
+    const record* table = (const record*)(file.data+sizeof(file_header));
+    for(uint32_t c1=0;c1<header->record_count;c1++)
+    {
+      if(table[c1].offset > file.size || table[c1].size > file.size-table[c1].offset)continue;
+      records[table[c1].key.hash] = table[c1];
+    }
+  }
+  template<class List> bool lookup(const mesh_key& key, List& out)
+  {
+    if(!enabled || key.overflow)return false;
+    scoped_lock hold(lock);
+    const unsigned char* data = NULL;
+    const record* found = NULL;
+    std::map<uint64_t,record>::iterator stored = records.find(key.hash);
+    std::map<uint64_t,pending_record>::iterator pending = added.find(key.hash);
+    if(stored != records.end())
+    {
+      found = &stored->second;
+      data = file.data+found->offset;
+    }
+    else if(pending != added.end())
+    {
+      found = &pending->second.header;
+      data = pending->second.data;
+    }
+    if(found == NULL || !(found->key == key) || found->size % sizeof(out[0]) != 0)return false;
+    typedef typename List::value_type value_type;
+    out.assign((const value_type*)data,(const value_type*)(data+found->size));
+    random_stream& stream = thread_random();
+    stream.key = found->stream_key;
+    stream.counter = found->stream_counter;
+    return true;
+  }
+  template<class List> void store(const mesh_key& key, const List& values)
+  {
+    if(!enabled || key.overflow)return;
+    scoped_lock hold(lock);
+    if(records.count(key.hash) || added.count(key.hash))return;
+    pending_record& entry = added[key.hash];
+    entry.header.key = key;
+    entry.header.stream_key = thread_random().key;
+    entry.header.stream_counter = thread_random().counter;
+    entry.header.offset = 0;
+    entry.header.size = values.size()*sizeof(values[0]);
+    entry.data = (unsigned char*)malloc(entry.header.size+1);
+    if(!values.empty())memcpy(entry.data,&values[0],entry.header.size);
+    added_bytes += entry.header.size;
+  }
+  //writes the file again if anything was added. old records are carried over unless that would go past size_limit,
+  //in which case only this run's are kept
+  bool save(size_t size_limit)
+  {
+    if(!enabled || added.empty())return true;
+    scoped_lock hold(lock);
+    std::vector<record> table;
+    std::vector<const unsigned char*> sources;
+    size_t old_bytes = 0;
+    for(std::map<uint64_t,record>::iterator c1=records.begin();c1!=records.end();c1++)
+    {
+      old_bytes += c1->second.size;
     }
-    for(int c1=0;c1<1;c1++)
+    if(old_bytes+added_bytes <= size_limit)
     {
-      uvmap->drawline(0,127-c1,uvmap->texture_width,127-c1,255,255,255,255);
-      uvmap->drawline(0,64+c1,uvmap->texture_width,64+c1,255,255,255,255);
+      for(std::map<uint64_t,record>::iterator c1=records.begin();c1!=records.end();c1++)
+      {
+        table.push_back(c1->second);
+        sources.push_back(file.data+c1->second.offset);
+      }
+    }
+    for(std::map<uint64_t,pending_record>::iterator c1=added.begin();c1!=added.end();c1++)
+    {
+      table.push_back(c1->second.header);
+      sources.push_back(c1->second.data);
+    }
+    file_header header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,"CPDCACHE",8);
+    header.version = VERSION;
+    header.triangle_size = sizeof(triangle_type);
+    header.record_size = sizeof(record);
+    header.record_count = uint32_t(table.size());
+    uint64_t offset = sizeof(file_header)+table.size()*sizeof(record);
+    for(size_t c1=0;c1<table.size();c1++)
+    {
+      offset = (offset+15) & ~uint64_t(15); //keeps every record aligned for the types stored in it
+      table[c1].offset = offset;
+      offset += table[c1].size;
+    }
+    //written next to the old file and moved over it, so a run that's killed halfway doesn't leave a broken cache
+    std::string temp_path = file_path+".tmp";
+    FILE* out = fopen(temp_path.c_str(),"wb");
+    if(out == NULL)return false;
+    bool ok = fwrite(&header,sizeof(header),1,out) == 1;
+    if(!table.empty())ok = ok && fwrite(&table[0],sizeof(record),table.size(),out) == table.size();
+    const char zeros[16] = {0};
+    uint64_t position = sizeof(file_header)+table.size()*sizeof(record);
+    for(size_t c1=0;c1<table.size() && ok;c1++)
+    {
+      size_t padding = size_t(table[c1].offset-position);
+      ok = fwrite(zeros,1,padding,out) == padding;
+      ok = ok && fwrite(sources[c1],1,size_t(table[c1].size),out) == size_t(table[c1].size);
+      position = table[c1].offset+table[c1].size;
+    }
+    ok = (fclose(out) == 0) && ok;
+    file.close();
+    records.clear();
+    if(ok)
+    {
+      remove(file_path.c_str());
+      ok = rename(temp_path.c_str(),file_path.c_str()) == 0;
     }
+    if(!ok)remove(temp_path.c_str());
+    discard_added();
+    open(file_path.c_str());
+    return ok;
   }
-  bool visible;
-  bool use_uvmap;
-  texture_image* uvmap;
-  tuple3<float> position;
-  tuple3<float> rotation;
-  std::vector<triangle_type> triangles;
+  bool enabled;
+  
+  private:
+  enum {VERSION = 1};
+  struct file_header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t triangle_size; //a different build's vertex layout can't be read
+    uint32_t record_size;
+    uint32_t record_count;
+  };
+  struct record
+  {
+    mesh_key key;
+    uint64_t stream_key; //where the generating thread's random stream was left
+    uint64_t stream_counter;
+    uint64_t offset; //from the start of the file
+    uint64_t size; //in bytes
+  };
+  struct pending_record
+  {
+    record header;
+    unsigned char* data;
+  };
+  void discard_added()
+  {
+    for(std::map<uint64_t,pending_record>::iterator c1=added.begin();c1!=added.end();c1++)
+    {
+      free(c1->second.data);
+    }
+    added.clear();
+    added_bytes = 0;
+  }
+  std::string file_path;
+  mapped_file file;
+  std::map<uint64_t,record> records;
+  std::map<uint64_t,pending_record> added;
+  size_t added_bytes;
+  mutex_type lock;
 };
 
+#define SCENE_CACHE_FILE "correspondence_problem_demo.cache"
+#define SCENE_CACHE_LIMIT (64<<20) //bytes, past this only the latest run's scene is kept
+
+disk_cache scene_disk_cache;
+
+//key plus everything else a generator's output depends on: the seed and where the calling thread's random stream is
+mesh_key seeded_key(const mesh_key& key)
+{
+  mesh_key retval = key;
+  const random_stream& stream = thread_random();
+  retval << random_seed << stream.key << stream.counter;
+  return retval;
+}
+
 object3d* generate_ngon_prism(unsigned int num_sides, float radius, float length)
 {
   object3d* obj = new object3d;
+  obj->triangles.reserve(4*num_sides); //a rectangle and two caps per side
+  const trig_table& ring = get_trig_table(num_sides);
   for(unsigned int c1=0;c1<num_sides;c1++)
   {
-    float x1 = radius*cos(2*PI*c1/num_sides);
-    float z1 = radius*sin(2*PI*c1/num_sides);
-    float x2 = radius*cos(2*PI*(c1+1)/num_sides);
-    float z2 = radius*sin(2*PI*(c1+1)/num_sides);
-    std::vector<triangle_type> tmp = triangles_from_rectangle(make_tuple3(x1,0.0f,z1),make_tuple3(x2,0.0f,z2),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),random_color());
-    for(int c2=0;c2<tmp.size();c2++)
-    {
-      obj->triangles.push_back(tmp[c2]);
-    }
+    float x1 = radius*ring.circle_cos[c1];
+    float z1 = radius*ring.circle_sin[c1];
+    float x2 = radius*ring.circle_cos[c1+1];
+    float z2 = radius*ring.circle_sin[c1+1];
+    triangles_from_rectangle(make_tuple3(x1,0.0f,z1),make_tuple3(x2,0.0f,z2),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),random_color(),std::back_inserter(obj->triangles));
     obj->triangles.push_back(triangle_from_points(make_tuple3<float>(0,0,0),make_tuple3(x1,0.0f,z1),make_tuple3(x2,0.0f,z2),random_color()));
     obj->triangles.push_back(triangle_from_points(make_tuple3<float>(0,length,0),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),random_color()));
   }
@@ -496,22 +3893,20 @@ object3d* generate_ngon_prism(unsigned int num_sides, float radius, float length
 object3d* generate_ngon_prism_uv(unsigned int num_sides, float radius, float length)
 {
   object3d* obj = new object3d;
+  obj->triangles.reserve(4*num_sides); //a rectangle and two caps per side
   obj->use_uvmap = true;
+  const trig_table& ring = get_trig_table(num_sides);
   for(unsigned int c1=0;c1<num_sides;c1++)
   {
-    float x1 = radius*cos(2*PI*c1/num_sides);
-    float z1 = radius*sin(2*PI*c1/num_sides);
-    float x2 = radius*cos(2*PI*(c1+1)/num_sides);
-    float z2 = radius*sin(2*PI*(c1+1)/num_sides);
+    float x1 = radius*ring.circle_cos[c1];
+    float z1 = radius*ring.circle_sin[c1];
+    float x2 = radius*ring.circle_cos[c1+1];
+    float z2 = radius*ring.circle_sin[c1+1];
     float u1 = float(c1)/num_sides;
     float v1 = 1;
     float u2 = float(c1+1)/num_sides;
     float v2 = .5;
-    std::vector<triangle_type> tmp = triangles_from_rectangle(make_tuple3(x1,0.0f,z1),make_tuple3(x2,0.0f,z2),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),u1,v1,u2,v2,random_color());
-    for(int c2=0;c2<tmp.size();c2++)
-    {
-      obj->triangles.push_back(tmp[c2]);
-    }
+    triangles_from_rectangle(make_tuple3(x1,0.0f,z1),make_tuple3(x2,0.0f,z2),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),u1,v1,u2,v2,random_color(),std::back_inserter(obj->triangles));
     u1 = .25;
     v1 = .25;
     u2 = u1+.25*x1/radius;
@@ -527,190 +3922,846 @@ object3d* generate_ngon_prism_uv(unsigned int num_sides, float radius, float len
     v3 = v1+.25*z2/radius;
     obj->triangles.push_back(triangle_from_points(make_tuple3<float>(0,length,0),make_tuple3(x1,length,z1),make_tuple3(x2,length,z2),make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v2),make_tuple2(u3,v3)),random_color()));
   }
-  obj->initialize_uvmap();
-  return obj;
-}
-
-object3d* generate_ngon_prism(unsigned int num_sides, float radius, tuple3<float> endpoint, tuple4<float> color)
-{
-  object3d* obj = new object3d;
-  bool use_rand_color = (color.z == 0);
-  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
-  tuple3<float> rotation;
-  rotation.x = atan2(endpoint.z,endpoint.x);
-  rotation.y = -acos(endpoint.y/magnitude);
-  rotation.z = 0;
-  for(unsigned int c1=0;c1<num_sides;c1++)
+  obj->initialize_uvmap();
+  return obj;
+}
+
+object3d* generate_ngon_prism(unsigned int num_sides, float radius, tuple3<float> endpoint, tuple4<float> color)
+{
+  object3d* obj = new object3d;
+  bool use_rand_color = (color.z == 0);
+  obj->triangles.reserve(4*num_sides); //a rectangle and two caps per side
+  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
+  tuple3<float> rotation;
+  rotation.x = atan2(endpoint.z,endpoint.x);
+  rotation.y = -acos(endpoint.y/magnitude);
+  rotation.z = 0;
+  mat3 rotation_matrix = mat3::from_rotation(rotation);
+  const trig_table& ring = get_trig_table(num_sides);
+  for(unsigned int c1=0;c1<num_sides;c1++)
+  {
+    float x1 = radius*ring.circle_cos[c1];
+    float z1 = radius*ring.circle_sin[c1];
+    float x2 = radius*ring.circle_cos[c1+1];
+    float z2 = radius*ring.circle_sin[c1+1];
+    if(use_rand_color)color = random_color();
+    triangles_from_rectangle(rotation_matrix*make_tuple3(x1,0.0f,z1),rotation_matrix*make_tuple3(x2,0.0f,z2),rotation_matrix*make_tuple3(x1,magnitude,z1),rotation_matrix*make_tuple3(x2,magnitude,z2),color,std::back_inserter(obj->triangles));
+    if(use_rand_color)color = random_color();
+    obj->triangles.push_back(triangle_from_points(rotation_matrix*make_tuple3<float>(0,0,0),rotation_matrix*make_tuple3(x1,0.0f,z1),rotation_matrix*make_tuple3(x2,0.0f,z2),color));
+    if(use_rand_color)color = random_color();
+    obj->triangles.push_back(triangle_from_points(rotation_matrix*make_tuple3<float>(0,magnitude,0),rotation_matrix*make_tuple3(x1,magnitude,z1),rotation_matrix*make_tuple3(x2,magnitude,z2),color));
+  }
+  return obj;
+}
+
+//writes the 2*num_sides triangles of generate_ngon_tube, moved to start, into out. the two rings of the tube are
+//placed in one go by the simd transform kernel, in scratch, which callers keep around between tubes
+void emit_ngon_tube(unsigned int num_sides, float radius, tuple3<float> start, tuple3<float> endpoint, tuple4<float> color, triangle_type* out, soa_positions& scratch)
+{
+  bool use_rand_color = (color.z == 0);
+  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
+  tuple3<float> rotation;
+  rotation.x = atan2(endpoint.z,endpoint.x);
+  rotation.y = -acos(endpoint.y/magnitude);
+  rotation.z = 0;
+  mat3 rotation_matrix = mat3::from_rotation(rotation);
+  const trig_table& ring = get_trig_table(num_sides);
+  //the bottom ring first, then the top one, each with the first point repeated at the end
+  size_t ring_size = num_sides+1;
+  scratch.resize(2*ring_size);
+  for(size_t c1=0;c1<ring_size;c1++)
+  {
+    scratch.x[c1] = scratch.x[ring_size+c1] = radius*ring.circle_cos[c1];
+    scratch.y[c1] = 0;
+    scratch.y[ring_size+c1] = magnitude;
+    scratch.z[c1] = scratch.z[ring_size+c1] = radius*ring.circle_sin[c1];
+  }
+  scratch.transform(mat4::from_mat3(rotation_matrix,start));
+  for(unsigned int c1=0;c1<num_sides;c1++)
+  {
+    if(use_rand_color)color = random_color();
+    tuple3<float> a = make_tuple3(scratch.x[c1],scratch.y[c1],scratch.z[c1]);
+    tuple3<float> b = make_tuple3(scratch.x[c1+1],scratch.y[c1+1],scratch.z[c1+1]);
+    tuple3<float> c = make_tuple3(scratch.x[ring_size+c1],scratch.y[ring_size+c1],scratch.z[ring_size+c1]);
+    tuple3<float> d = make_tuple3(scratch.x[ring_size+c1+1],scratch.y[ring_size+c1+1],scratch.z[ring_size+c1+1]);
+    out = triangles_from_rectangle(a,b,c,d,color,out);
+  }
+}
+
+object3d* generate_ngon_tube(unsigned int num_sides, float radius, tuple3<float> endpoint, tuple4<float> color)
+{
+  object3d* obj = new object3d;
+  mesh_key key("ngon_tube");
+  key << num_sides << radius << endpoint << color;
+  bool cacheable = CACHE_GENERATED_MESHES && color.z != 0;
+  if(cacheable && generated_meshes.lookup(key,obj->triangles))return obj;
+  obj->triangles.resize(2*num_sides);
+  soa_positions scratch;
+  emit_ngon_tube(num_sides,radius,make_tuple3<float>(0,0,0),endpoint,color,&obj->triangles[0],scratch);
+  if(cacheable)generated_meshes.store(key,obj->triangles);
+  return obj;
+}
+
+object3d* generate_ngon_prism_uv(unsigned int num_sides, float radius, tuple3<float> endpoint)
+{
+  object3d* obj = new object3d;
+  obj->triangles.reserve(4*num_sides); //a rectangle and two caps per side
+  obj->use_uvmap = true;
+  mesh_key disk_key = seeded_key(mesh_key("ngon_prism_uv") << num_sides << radius << endpoint);
+  if(scene_disk_cache.lookup(disk_key,obj->triangles))
+  {
+    obj->initialize_uvmap();
+    return obj;
+  }
+  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
+  tuple3<float> rotation;
+  rotation.x = atan2(endpoint.z,endpoint.x);
+  rotation.y = -acos(endpoint.y/magnitude);
+  rotation.z = 0;
+  mat3 rotation_matrix = mat3::from_rotation(rotation);
+  const trig_table& ring = get_trig_table(num_sides);
+  for(unsigned int c1=0;c1<num_sides;c1++)
+  {
+    float x1 = radius*ring.circle_cos[c1];
+    float z1 = radius*ring.circle_sin[c1];
+    float x2 = radius*ring.circle_cos[c1+1];
+    float z2 = radius*ring.circle_sin[c1+1];
+    float u1 = float(c1)/num_sides;
+    float v1 = 1;
+    float u2 = float(c1+1)/num_sides;
+    float v2 = .5;
+    triangles_from_rectangle(rotation_matrix*make_tuple3(x1,0.0f,z1),rotation_matrix*make_tuple3(x2,0.0f,z2),rotation_matrix*make_tuple3(x1,magnitude,z1),rotation_matrix*make_tuple3(x2,magnitude,z2),u1,v1,u2,v2,random_color(),std::back_inserter(obj->triangles));
+    u1 = .25;
+    v1 = .25;
+    u2 = u1+.25*x1/radius;
+    v2 = v1+.25*z1/radius;
+    float u3 = u1+.25*x2/radius;
+    float v3 = v1+.25*z2/radius;
+    obj->triangles.push_back(triangle_from_points(rotation_matrix*make_tuple3<float>(0,0,0),rotation_matrix*make_tuple3(x1,0.0f,z1),rotation_matrix*make_tuple3(x2,0.0f,z2),make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v2),make_tuple2(u3,v3)),random_color()));
+    u1 = .75;
+    v1 = .25;
+    u2 = u1+.25*x1/radius;
+    v2 = v1+.25*z1/radius;
+    u3 = u1+.25*x2/radius;
+    v3 = v1+.25*z2/radius;
+    obj->triangles.push_back(triangle_from_points(rotation_matrix*make_tuple3<float>(0,magnitude,0),rotation_matrix*make_tuple3(x1,magnitude,z1),rotation_matrix*make_tuple3(x2,magnitude,z2),make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v2),make_tuple2(u3,v3)),random_color()));
+  }
+  scene_disk_cache.store(disk_key,obj->triangles);
+  obj->initialize_uvmap();
+  return obj;
+}
+
+//writes the 2*num_vert_segments triangles for each of sides [first_side,end_side) of generate_sphereoid, moved to center, into out
+void emit_sphereoid_sides(unsigned int num_sides, unsigned int num_vert_segments, tuple3<float> radius, tuple4<float> color, tuple3<float> center, unsigned int first_side, unsigned int end_side, triangle_type* out)
+{
+  bool use_rand_color = (color.z == 0);
+  const trig_table& ring = get_trig_table(num_sides);
+  const trig_table& latitude = get_trig_table(num_vert_segments);
+  for(int c1=first_side;c1<end_side;c1++)
+  {
+    for(int c2=0;c2<num_vert_segments;c2++)
+    {
+      float height1 = radius.y*latitude.latitude_cos[c2];
+      float height2 = radius.y*latitude.latitude_cos[c2+1];
+      tuple3<float> p1 = make_tuple3<float>(radius.x*latitude.latitude_sin[c2]*ring.longitude_cos[c1],height1,radius.z*latitude.latitude_sin[c2]*ring.longitude_sin[c1]);
+      tuple3<float> p2 = make_tuple3<float>(radius.x*latitude.latitude_sin[c2+1]*ring.longitude_cos[c1],height2,radius.z*latitude.latitude_sin[c2+1]*ring.longitude_sin[c1]);
+      tuple3<float> p3 = make_tuple3<float>(radius.x*latitude.latitude_sin[c2]*ring.longitude_cos[c1+1],height1,radius.z*latitude.latitude_sin[c2]*ring.longitude_sin[c1+1]);
+      tuple3<float> p4 = make_tuple3<float>(radius.x*latitude.latitude_sin[c2+1]*ring.longitude_cos[c1+1],height2,radius.z*latitude.latitude_sin[c2+1]*ring.longitude_sin[c1+1]);
+      if(use_rand_color)color = random_color();
+      p1 = p1+center;
+      p2 = p2+center;
+      p3 = p3+center;
+      p4 = p4+center;
+      out = triangles_from_rectangle(p1,p2,p3,p4,color,out);
+    }
+  }
+}
+
+//all 2*num_sides*num_vert_segments triangles of generate_sphereoid
+void emit_sphereoid(unsigned int num_sides, unsigned int num_vert_segments, tuple3<float> radius, tuple4<float> color, tuple3<float> center, triangle_type* out)
+{
+  emit_sphereoid_sides(num_sides,num_vert_segments,radius,color,center,0,num_sides,out);
+}
+
+struct sphereoid_task : public parallel_task
+{
+  unsigned int num_sides;
+  unsigned int num_vert_segments;
+  tuple3<float> radius;
+  tuple4<float> color;
+  triangle_type* triangles;
+  uint64_t stream_base;
+  void run(size_t begin, size_t end)
+  {
+    random_stream_scope scope;
+    for(size_t c1=begin;c1<end;c1++)
+    {
+      select_random_stream(stream_base+c1);
+      emit_sphereoid_sides(num_sides,num_vert_segments,radius,color,make_tuple3<float>(0,0,0),c1,c1+1,&triangles[c1*2*num_vert_segments]);
+    }
+  }
+};
+
+object3d* generate_sphereoid(unsigned int num_sides, unsigned int num_vert_segments, tuple3<float> radius,tuple4<float> color)
+{
+  object3d* obj = new object3d;
+  mesh_key key("sphereoid");
+  key << num_sides << num_vert_segments << radius << color;
+  bool cacheable = CACHE_GENERATED_MESHES && color.z != 0;
+  if(cacheable && generated_meshes.lookup(key,obj->triangles))return obj;
+  mesh_key disk_key = seeded_key(mesh_key("sphereoid") << num_sides << num_vert_segments << radius << color);
+  if(scene_disk_cache.lookup(disk_key,obj->triangles))return obj;
+  obj->triangles.resize(2*num_sides*num_vert_segments);
+  if(obj->triangles.empty())return obj;
+  sphereoid_task task;
+  task.num_sides = num_sides;
+  task.num_vert_segments = num_vert_segments;
+  task.radius = radius;
+  task.color = color;
+  task.triangles = &obj->triangles[0];
+  //a single colored sphere leaves the random stream alone, so it doesn't matter whether it came from the cache
+  task.stream_base = (color.z == 0) ? thread_random().next_u64() : 0;
+  //chunks of a few thousand triangles, so small spheres stay on the calling thread
+  parallel_for(num_sides,std::max(1u,2048/std::max(1u,num_vert_segments)),task);
+  scene_disk_cache.store(disk_key,obj->triangles);
+  if(cacheable)generated_meshes.store(key,obj->triangles);
+  return obj;
+}
+
+//the y of every segment the spirals' float loop over y visits, so buffers can be sized exactly and the segments generated
+//in any order (accumulating y again from 0 wouldn't round the same way)
+void spiral_heights(unsigned int vert_segments, unsigned int height, std::vector<float>& heights)
+{
+  heights.clear();
+  float deltay = float(height)/vert_segments;
+  for(float y=0;y<height;y += deltay)
+  {
+    heights.push_back(y);
+  }
+}
+
+//writes segments [begin,end) of a spiral into their own slots of the output, so pool threads can share the work
+struct spiral_task : public parallel_task
+{
+  enum output_kind {TUBES, SPHEREOIDS, POINTS};
+  output_kind kind;
+  const float* heights;
+  unsigned int ngon_segments;
+  float radius;
+  float thickness;
+  float deltay;
+  tuple4<float> color;
+  triangle_type* triangles; //6 per segment for TUBES, 12 for SPHEREOIDS
+  tuple3<float>* points; //1 per segment for POINTS
+  //when set (single color), the finished tube of each side, or the one dot, at the origin: segments copy theirs into place
+  //instead of generating it, since every turn of the helix repeats the same ngon_segments shapes
+  const triangle_type* shapes;
+  uint64_t stream_base; //segment n draws its random colors from stream stream_base+n
+  const trig_table* ring;
+  tuple3<float> helix_point(int circpoint, float y)
+  {
+    circpoint %= ngon_segments;
+    return make_tuple3<float>(radius*ring->circle_cos[circpoint],y,radius*ring->circle_sin[circpoint]);
+  }
+  //from a segment starting on side to the next one
+  tuple3<float> side_delta(int side)
+  {
+    return make_tuple3<float>(radius*(ring->circle_cos[side+1]-ring->circle_cos[side]),deltay,radius*(ring->circle_sin[side+1]-ring->circle_sin[side]));
+  }
+  void run(size_t begin, size_t end)
+  {
+    random_stream_scope scope;
+    soa_positions scratch;
+    for(size_t c1=begin;c1<end;c1++)
+    {
+      select_random_stream(stream_base+c1);
+      float y = heights[c1];
+      int circpoint = y/deltay;
+      tuple3<float> start = helix_point(circpoint,y);
+      if(kind == POINTS)
+      {
+        points[c1] = start;
+      }
+      else if(shapes != NULL)
+      {
+        size_t count = (kind == SPHEREOIDS) ? 12 : 6;
+        const triangle_type* shape = (kind == SPHEREOIDS) ? shapes : &shapes[(circpoint%ngon_segments)*count];
+        for(size_t c2=0;c2<count;c2++)
+        {
+          triangle_type& tri = triangles[c1*count+c2];
+          tri = shape[c2];
+          for(int c3=0;c3<3;c3++)
+          {
+            tri.verts[c3].pos = tri.verts[c3].pos+start;
+          }
+        }
+      }
+      else if(kind == SPHEREOIDS)
+      {
+        emit_sphereoid(3,2,make_tuple3<float>(thickness,thickness,thickness),color,start,&triangles[c1*12]);
+      }
+      else
+      {
+        emit_ngon_tube(3,thickness,start,side_delta(circpoint%ngon_segments),color,&triangles[c1*6],scratch);
+      }
+    }
+  }
+};
+
+spiral_task make_spiral_task(spiral_task::output_kind kind, const std::vector<float>& heights, unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
+{
+  spiral_task task;
+  task.kind = kind;
+  task.heights = heights.empty() ? NULL : &heights[0];
+  task.ngon_segments = ngon_segments;
+  task.ring = &get_trig_table(ngon_segments);
+  task.radius = radius;
+  task.thickness = thickness;
+  task.deltay = float(height)/vert_segments;
+  task.color = color;
+  task.triangles = NULL;
+  task.points = NULL;
+  task.shapes = NULL;
+  task.stream_base = thread_random().next_u64();
+  return task;
+}
+
+#define SPIRAL_GRAIN 1024 //segments per chunk handed to the pool
+
+//the centerline of the tubes generate_spiral would make, as a polyline
+object3d* generate_spiral_polyline(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
+{
+  object3d* obj = new object3d;
+  obj->line = new polyline;
+  //a triangular tube of circumradius thickness is between 1.5 and sqrt(3) times that wide depending on the angle
+  obj->line->width = sqrt(3.0f)*thickness;
+  obj->line->color = color;
+  mesh_key disk_key = seeded_key(mesh_key("spiral_polyline") << ngon_segments << vert_segments << height << radius << thickness << color);
+  if(scene_disk_cache.lookup(disk_key,obj->line->points))return obj;
+  std::vector<float> heights;
+  spiral_heights(vert_segments,height,heights);
+  if(heights.empty())return obj;
+  //plus the far end of the last segment
+  obj->line->points.resize(heights.size()+1);
+  spiral_task task = make_spiral_task(spiral_task::POINTS,heights,ngon_segments,vert_segments,height,radius,thickness,color);
+  task.points = &obj->line->points[0];
+  parallel_for(heights.size(),SPIRAL_GRAIN,task);
+  obj->line->points.back() = task.helix_point(int(heights.back()/task.deltay)+1,heights.back()+task.deltay);
+  scene_disk_cache.store(disk_key,obj->line->points);
+  return obj;
+}
+
+object3d* generate_spiral(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
+{
+  if(THIN_SPIRALS_AS_LINES)return generate_spiral_polyline(ngon_segments,vert_segments,height,radius,thickness,color);
+  //sweeps the tube's cross section along the helix straight into one buffer, rather than a temporary object per segment
+  object3d* obj = new object3d;
+  mesh_key disk_key = seeded_key(mesh_key("spiral") << ngon_segments << vert_segments << height << radius << thickness << color);
+  if(scene_disk_cache.lookup(disk_key,obj->triangles))return obj;
+  std::vector<float> heights;
+  spiral_heights(vert_segments,height,heights);
+  if(heights.empty())return obj;
+  obj->triangles.resize(heights.size()*6);
+  spiral_task task = make_spiral_task(spiral_task::TUBES,heights,ngon_segments,vert_segments,height,radius,thickness,color);
+  task.triangles = &obj->triangles[0];
+  triangle_list shapes;
+  if(CACHE_GENERATED_MESHES && color.z != 0)
+  {
+    shapes.reserve(ngon_segments*6);
+    for(unsigned int c1=0;c1<ngon_segments;c1++)
+    {
+      object3d* tube = generate_ngon_tube(3,thickness,task.side_delta(c1),color);
+      shapes.insert(shapes.end(),tube->triangles.begin(),tube->triangles.end());
+      delete tube;
+    }
+    task.shapes = &shapes[0];
+  }
+  parallel_for(heights.size(),SPIRAL_GRAIN,task);
+  scene_disk_cache.store(disk_key,obj->triangles);
+  return obj;
+}
+
+//same dots as generate_dotted_spiral, as a dot_cloud
+object3d* generate_dotted_spiral_points(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
+{
+  object3d* obj = new object3d;
+  obj->dots = new dot_cloud;
+  obj->dots->radius = thickness;
+  obj->dots->color = color;
+  mesh_key disk_key = seeded_key(mesh_key("dotted_spiral_points") << ngon_segments << vert_segments << height << radius << thickness << color);
+  if(scene_disk_cache.lookup(disk_key,obj->dots->centers))return obj;
+  std::vector<float> heights;
+  spiral_heights(vert_segments,height,heights);
+  if(heights.empty())return obj;
+  obj->dots->centers.resize(heights.size());
+  spiral_task task = make_spiral_task(spiral_task::POINTS,heights,ngon_segments,vert_segments,height,radius,thickness,color);
+  task.points = &obj->dots->centers[0];
+  parallel_for(heights.size(),SPIRAL_GRAIN,task);
+  scene_disk_cache.store(disk_key,obj->dots->centers);
+  return obj;
+}
+
+object3d* generate_dotted_spiral(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
+{
+  if(DOTTED_SPIRAL_AS_POINTS)return generate_dotted_spiral_points(ngon_segments,vert_segments,height,radius,thickness,color);
+  //12 triangles per dot, written in place like generate_spiral's segments
+  object3d* obj = new object3d;
+  mesh_key disk_key = seeded_key(mesh_key("dotted_spiral") << ngon_segments << vert_segments << height << radius << thickness << color);
+  if(scene_disk_cache.lookup(disk_key,obj->triangles))return obj;
+  std::vector<float> heights;
+  spiral_heights(vert_segments,height,heights);
+  if(heights.empty())return obj;
+  obj->triangles.resize(heights.size()*12);
+  spiral_task task = make_spiral_task(spiral_task::SPHEREOIDS,heights,ngon_segments,vert_segments,height,radius,thickness,color);
+  task.triangles = &obj->triangles[0];
+  object3d* dot = NULL;
+  if(CACHE_GENERATED_MESHES && color.z != 0)
+  {
+    dot = generate_sphereoid(3,2,make_tuple3<float>(thickness,thickness,thickness),color);
+    task.shapes = &dot->triangles[0];
+  }
+  parallel_for(heights.size(),SPIRAL_GRAIN,task);
+  delete dot;
+  scene_disk_cache.store(disk_key,obj->triangles);
+  return obj;
+}
+
+//Moller-Trumbore, returns the distance along direction to the hit (negative for a miss)
+float ray_triangle_distance(const tuple3<float>& origin, const tuple3<float>& direction, tuple3<float> a, tuple3<float> b, tuple3<float> c)
+{
+  tuple3<float> edge1 = b-a;
+  tuple3<float> edge2 = c-a;
+  tuple3<float> p = make_tuple3(direction.y*edge2.z - direction.z*edge2.y,direction.z*edge2.x - direction.x*edge2.z,direction.x*edge2.y - direction.y*edge2.x);
+  float det = edge1.x*p.x + edge1.y*p.y + edge1.z*p.z;
+  if(absolute(det) < 1e-12f)return -1;
+  tuple3<float> t = make_tuple3(origin.x-a.x,origin.y-a.y,origin.z-a.z);
+  float u = (t.x*p.x + t.y*p.y + t.z*p.z)/det;
+  if(u < 0 || u > 1)return -1;
+  tuple3<float> q = make_tuple3(t.y*edge1.z - t.z*edge1.y,t.z*edge1.x - t.x*edge1.z,t.x*edge1.y - t.y*edge1.x);
+  float v = (direction.x*q.x + direction.y*q.y + direction.z*q.z)/det;
+  if(v < 0 || u+v > 1)return -1;
+  return (edge2.x*q.x + edge2.y*q.y + edge2.z*q.z)/det;
+}
+
+//bounding volume hierarchy over a scene's objects, for frustum culling and ray picking without visiting every object.
+//each object is bounded by a sphere around its origin that contains it at any rotation, so the main loop spinning
+//everything needs no refitting, only moving an object or changing its geometry does (and then only its path to the root)
+class scene_bvh
+{
+  public:
+  struct node
+  {
+    tuple3<float> low;
+    tuple3<float> high;
+    int parent;
+    int children[2]; //-1 for leaves
+    int first_item; //leaves only, their range in items
+    int item_count;
+  };
+  struct item
+  {
+    object3d* obj;
+    int object_index;
+    tuple3<float> position;
+    float radius;
+    int leaf;
+  };
+  struct item_center_less
+  {
+    int axis;
+    bool operator()(const item& a, const item& b) const
+    {
+      if(axis == 0)return a.position.x < b.position.x;
+      if(axis == 1)return a.position.y < b.position.y;
+      return a.position.z < b.position.z;
+    }
+  };
+  static const int LEAF_SIZE = 4;
+  static const int LOOSE_LIMIT = 64; //inserted items kept outside the tree (and tested one by one) before a rebuild
+  scene_bvh() : tree_items(0), removed_items(0), needs_build(true) {}
+  //rebuilds after objects_changed (or enough inserts and removes), otherwise only refits the objects that called moved()
+  void sync(const std::vector<object3d*>& objects)
+  {
+    if(needs_build)build(objects);
+    else refit();
+  }
+  //call after changing the objects vector in any way that insert and remove don't cover
+  void objects_changed()
+  {
+    needs_build = true;
+  }
+  //obj was added at object_index. it's tested on its own until the next rebuild puts it in the tree
+  void insert(object3d* obj, int object_index)
+  {
+    item tmp;
+    tmp.obj = obj;
+    tmp.object_index = object_index;
+    tmp.leaf = -1;
+    update_item(tmp);
+    attach(obj,items.size());
+    items.push_back(tmp);
+    if(int(items.size())-tree_items > LOOSE_LIMIT)needs_build = true;
+  }
+  //obj is no longer in the objects vector, which mustn't have moved any other object to a new index (it was the last one)
+  void remove(object3d* obj)
+  {
+    int index = obj->bvh_item;
+    if(index == -1)return;
+    if(obj->bvh_refit_pending)moved.erase(std::find(moved.begin(),moved.end(),obj));
+    detach(obj);
+    if(index >= tree_items)
+    {
+      //loose items have no place in the tree to keep, the last one takes its slot
+      items[index] = items.back();
+      items.pop_back();
+      if(index < int(items.size()))items[index].obj->bvh_item = index;
+      return;
+    }
+    //tree items stay as holes (their bounds are still conservative) until there are enough to rebuild
+    items[index].obj = NULL;
+    removed_items++;
+    if(removed_items > tree_items/4)needs_build = true;
+  }
+  void build(const std::vector<object3d*>& objects)
+  {
+    release_items();
+    items.clear();
+    nodes.clear();
+    for(size_t c1=0;c1<objects.size();c1++)
+    {
+      if(objects[c1] == NULL)continue;
+      item tmp;
+      tmp.obj = objects[c1];
+      tmp.object_index = c1;
+      tmp.leaf = -1;
+      update_item(tmp);
+      items.push_back(tmp);
+    }
+    if(!items.empty())build_node(0,items.size(),-1);
+    //build_node reorders them, so the objects learn their slots afterwards
+    for(size_t c1=0;c1<items.size();c1++)
+    {
+      attach(items[c1].obj,c1);
+    }
+    tree_items = items.size();
+    removed_items = 0;
+    needs_build = false;
+  }
+  //only what moved, see object3d::moved
+  void refit()
+  {
+    for(size_t c1=0;c1<moved.size();c1++)
+    {
+      item& it = items[moved[c1]->bvh_item];
+      it.obj->bvh_refit_pending = false;
+      if(update_item(it))
+      {
+        for(int n=it.leaf;n != -1;n = nodes[n].parent)
+        {
+          update_node_bounds(n);
+        }
+      }
+    }
+    moved.clear();
+  }
+  //indices (into the objects vector) of everything whose bounding sphere might be in view, whole subtrees inside the
+  //frustum are taken without testing them any further
+  void query_frustum(const view_frustum& frustum, std::vector<int>& visible)
+  {
+    visible.clear();
+    if(nodes.empty())return;
+    stack.clear();
+    stack.push_back(0);
+    while(!stack.empty())
+    {
+      const node& n = nodes[stack.back()];
+      stack.pop_back();
+      int classification = frustum.classify_box(n.low,n.high);
+      if(classification < 0)continue;
+      if(n.children[0] == -1)
+      {
+        for(int c1=n.first_item;c1<n.first_item+n.item_count;c1++)
+        {
+          if(items[c1].obj == NULL)continue;
+          if(classification > 0 || frustum.sphere_visible(items[c1].position,items[c1].radius))visible.push_back(items[c1].object_index);
+        }
+      }
+      else if(classification > 0)
+      {
+        add_subtree(n,visible);
+      }
+      else
+      {
+        stack.push_back(n.children[0]);
+        stack.push_back(n.children[1]);
+      }
+    }
+    for(size_t c1=tree_items;c1<items.size();c1++)
+    {
+      if(frustum.sphere_visible(items[c1].position,items[c1].radius))visible.push_back(items[c1].object_index);
+    }
+  }
+  //nearest object whose triangles the ray hits, NULL if none, distance is in units of direction's length
+  object3d* pick(const tuple3<float>& origin, const tuple3<float>& direction, float& distance)
+  {
+    object3d* nearest = NULL;
+    distance = -1;
+    stack.clear();
+    if(!nodes.empty())stack.push_back(0);
+    while(!stack.empty())
+    {
+      const node& n = nodes[stack.back()];
+      stack.pop_back();
+      if(!ray_hits_box(origin,direction,n.low,n.high,(nearest != NULL) ? distance : -1))continue;
+      if(n.children[0] != -1)
+      {
+        stack.push_back(n.children[0]);
+        stack.push_back(n.children[1]);
+        continue;
+      }
+      for(int c1=n.first_item;c1<n.first_item+n.item_count;c1++)
+      {
+        pick_item(origin,direction,items[c1].obj,nearest,distance);
+      }
+    }
+    for(size_t c1=tree_items;c1<items.size();c1++)
+    {
+      pick_item(origin,direction,items[c1].obj,nearest,distance);
+    }
+    return nearest;
+  }
+  static void pick_item(const tuple3<float>& origin, const tuple3<float>& direction, object3d* obj, object3d*& nearest, float& distance)
   {
-    float x1 = radius*cos(2*PI*c1/num_sides);
-    float z1 = radius*sin(2*PI*c1/num_sides);
-    float x2 = radius*cos(2*PI*(c1+1)/num_sides);
-    float z2 = radius*sin(2*PI*(c1+1)/num_sides);
-    if(use_rand_color)color = random_color();
-    std::vector<triangle_type> tmp = triangles_from_rectangle(rotate_point(make_tuple3(x1,0.0f,z1),rotation),rotate_point(make_tuple3(x2,0.0f,z2),rotation),rotate_point(make_tuple3(x1,magnitude,z1),rotation),rotate_point(make_tuple3(x2,magnitude,z2),rotation),color);
-    for(int c2=0;c2<tmp.size();c2++)
+    if(obj == NULL || !obj->visible)return;
+    float hit = ray_object_distance(origin,direction,obj);
+    if(hit >= 0 && (nearest == NULL || hit < distance))
     {
-      obj->triangles.push_back(tmp[c2]);
+      nearest = obj;
+      distance = hit;
     }
-    if(use_rand_color)color = random_color();
-    obj->triangles.push_back(triangle_from_points(rotate_point(make_tuple3<float>(0,0,0),rotation),rotate_point(make_tuple3(x1,0.0f,z1),rotation),rotate_point(make_tuple3(x2,0.0f,z2),rotation),color));
-    if(use_rand_color)color = random_color();
-    obj->triangles.push_back(triangle_from_points(rotate_point(make_tuple3<float>(0,magnitude,0),rotation),rotate_point(make_tuple3(x1,magnitude,z1),rotation),rotate_point(make_tuple3(x2,magnitude,z2),rotation),color));
   }
-  return obj;
-}
-
-object3d* generate_ngon_tube(unsigned int num_sides, float radius, tuple3<float> endpoint, tuple4<float> color)
-{
-  object3d* obj = new object3d;
-  bool use_rand_color = (color.z == 0);
-  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
-  tuple3<float> rotation;
-  rotation.x = atan2(endpoint.z,endpoint.x);
-  rotation.y = -acos(endpoint.y/magnitude);
-  rotation.z = 0;
-  for(unsigned int c1=0;c1<num_sides;c1++)
+  static float ray_object_distance(const tuple3<float>& origin, const tuple3<float>& direction, object3d* obj)
   {
-    float x1 = radius*cos(2*PI*c1/num_sides);
-    float z1 = radius*sin(2*PI*c1/num_sides);
-    float x2 = radius*cos(2*PI*(c1+1)/num_sides);
-    float z2 = radius*sin(2*PI*(c1+1)/num_sides);
-    if(use_rand_color)color = random_color();
-    std::vector<triangle_type> tmp = triangles_from_rectangle(rotate_point(make_tuple3(x1,0.0f,z1),rotation),rotate_point(make_tuple3(x2,0.0f,z2),rotation),rotate_point(make_tuple3(x1,magnitude,z1),rotation),rotate_point(make_tuple3(x2,magnitude,z2),rotation),color);
-    for(int c2=0;c2<tmp.size();c2++)
+    //move the ray into object space instead of the triangles into world space, the inverse rotation is the transpose
+    mat3 inverse_rotation = mat3::from_rotation(obj->rotation).transposed();
+    tuple3<float> local_origin = inverse_rotation*make_tuple3(origin.x-obj->position.x,origin.y-obj->position.y,origin.z-obj->position.z);
+    tuple3<float> local_direction = inverse_rotation*direction;
+    if(obj->instances.empty())return ray_mesh_distance(local_origin,local_direction,obj);
+    //affine maps don't change where along the ray a hit is, so the distances stay comparable between instances
+    float nearest = -1;
+    mat3 spin = mat3::from_rotation(obj->instance_spin);
+    for(size_t c1=0;c1<obj->instances.size();c1++)
     {
-      obj->triangles.push_back(tmp[c2]);
+      const instance_type& inst = obj->instances[c1];
+      mat3 inverse_instance_rotation = (spin*mat3::from_rotation(inst.rotation)).transposed();
+      tuple3<float> o = inverse_instance_rotation*make_tuple3(local_origin.x-inst.position.x,local_origin.y-inst.position.y,local_origin.z-inst.position.z);
+      tuple3<float> d = inverse_instance_rotation*local_direction;
+      o = make_tuple3(o.x/inst.scale.x,o.y/inst.scale.y,o.z/inst.scale.z);
+      d = make_tuple3(d.x/inst.scale.x,d.y/inst.scale.y,d.z/inst.scale.z);
+      float hit = ray_mesh_distance(o,d,obj);
+      if(hit >= 0 && (nearest < 0 || hit < nearest))nearest = hit;
     }
+    return nearest;
   }
-  return obj;
-}
-
-object3d* generate_ngon_prism_uv(unsigned int num_sides, float radius, tuple3<float> endpoint)
-{
-  object3d* obj = new object3d;
-  obj->use_uvmap = true;
-  float magnitude = sqrt(endpoint.x*endpoint.x + endpoint.y*endpoint.y + endpoint.z*endpoint.z);
-  tuple3<float> rotation;
-  rotation.x = atan2(endpoint.z,endpoint.x);
-  rotation.y = -acos(endpoint.y/magnitude);
-  rotation.z = 0;
-  for(unsigned int c1=0;c1<num_sides;c1++)
+  static float ray_mesh_distance(const tuple3<float>& origin, const tuple3<float>& direction, object3d* obj)
   {
-    float x1 = radius*cos(2*PI*c1/num_sides);
-    float z1 = radius*sin(2*PI*c1/num_sides);
-    float x2 = radius*cos(2*PI*(c1+1)/num_sides);
-    float z2 = radius*sin(2*PI*(c1+1)/num_sides);
-    float u1 = float(c1)/num_sides;
-    float v1 = 1;
-    float u2 = float(c1+1)/num_sides;
-    float v2 = .5;
-    std::vector<triangle_type> tmp = triangles_from_rectangle(rotate_point(make_tuple3(x1,0.0f,z1),rotation),rotate_point(make_tuple3(x2,0.0f,z2),rotation),rotate_point(make_tuple3(x1,magnitude,z1),rotation),rotate_point(make_tuple3(x2,magnitude,z2),rotation),u1,v1,u2,v2,random_color());
-    for(int c2=0;c2<tmp.size();c2++)
+    float nearest = -1;
+    if(obj->dots != NULL)
     {
-      obj->triangles.push_back(tmp[c2]);
+      float a = direction.x*direction.x + direction.y*direction.y + direction.z*direction.z;
+      for(size_t c1=0;c1<obj->dots->centers.size();c1++)
+      {
+        const tuple3<float>& c = obj->dots->centers[c1];
+        tuple3<float> o = make_tuple3(origin.x-c.x,origin.y-c.y,origin.z-c.z);
+        float b = o.x*direction.x + o.y*direction.y + o.z*direction.z;
+        float discriminant = b*b - a*(o.x*o.x + o.y*o.y + o.z*o.z - obj->dots->radius*obj->dots->radius);
+        if(discriminant < 0)continue;
+        float hit = (-b-sqrt(discriminant))/a;
+        if(hit >= 0 && (nearest < 0 || hit < nearest))nearest = hit;
+      }
+      return nearest;
     }
-    u1 = .25;
-    v1 = .25;
-    u2 = u1+.25*x1/radius;
-    v2 = v1+.25*z1/radius;
-    float u3 = u1+.25*x2/radius;
-    float v3 = v1+.25*z2/radius;
-    obj->triangles.push_back(triangle_from_points(rotate_point(make_tuple3<float>(0,0,0),rotation),rotate_point(make_tuple3(x1,0.0f,z1),rotation),rotate_point(make_tuple3(x2,0.0f,z2),rotation),make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v2),make_tuple2(u3,v3)),random_color()));
-    u1 = .75;
-    v1 = .25;
-    u2 = u1+.25*x1/radius;
-    v2 = v1+.25*z1/radius;
-    u3 = u1+.25*x2/radius;
-    v3 = v1+.25*z2/radius;
-    obj->triangles.push_back(triangle_from_points(rotate_point(make_tuple3<float>(0,magnitude,0),rotation),rotate_point(make_tuple3(x1,magnitude,z1),rotation),rotate_point(make_tuple3(x2,magnitude,z2),rotation),make_tuple3(make_tuple2(u1,v1),make_tuple2(u2,v2),make_tuple2(u3,v3)),random_color()));
+    if(obj->line != NULL)
+    {
+      for(size_t c1=0;c1+1<obj->line->points.size();c1++)
+      {
+        float hit = ray_segment_distance(origin,direction,obj->line->points[c1],obj->line->points[c1+1],obj->line->width/2);
+        if(hit >= 0 && (nearest < 0 || hit < nearest))nearest = hit;
+      }
+      return nearest;
+    }
+    for(size_t c1=0;c1<obj->triangle_count();c1++)
+    {
+      float hit = ray_triangle_distance(origin,direction,obj->triangle_vertex(c1,0).pos,obj->triangle_vertex(c1,1).pos,obj->triangle_vertex(c1,2).pos);
+      if(hit >= 0 && (nearest < 0 || hit < nearest))nearest = hit;
+    }
+    return nearest;
   }
-  obj->initialize_uvmap();
-  return obj;
-}
-
-object3d* generate_sphereoid(unsigned int num_sides, unsigned int num_vert_segments, tuple3<float> radius,tuple4<float> color)
-{
-  object3d* obj = new object3d;
-  bool use_rand_color = (color.z == 0);
-  for(int c1=0;c1<num_sides;c1++)
+  //where the ray passes within radius of the segment a-b (its closest approach, not the capsule surface), -1 if it doesn't
+  static float ray_segment_distance(const tuple3<float>& origin, const tuple3<float>& direction, const tuple3<float>& a, const tuple3<float>& b, float radius)
   {
-    for(int c2=0;c2<num_vert_segments;c2++)
+    tuple3<float> u = direction;
+    tuple3<float> v = make_tuple3(b.x-a.x,b.y-a.y,b.z-a.z);
+    tuple3<float> w = make_tuple3(origin.x-a.x,origin.y-a.y,origin.z-a.z);
+    float uu = u.x*u.x + u.y*u.y + u.z*u.z;
+    float uv = u.x*v.x + u.y*v.y + u.z*v.z;
+    float vv = v.x*v.x + v.y*v.y + v.z*v.z;
+    float uw = u.x*w.x + u.y*w.y + u.z*w.z;
+    float vw = v.x*w.x + v.y*w.y + v.z*w.z;
+    float denominator = uu*vv - uv*uv;
+    float s = (denominator > 1e-12f) ? (uv*vw - vv*uw)/denominator : 0;
+    float t = (vv > 0) ? (vw + s*uv)/vv : 0;
+    //clamp to the segment, then find the closest point on the ray to that
+    if(t < 0)t = 0;
+    if(t > 1)t = 1;
+    s = (t*uv - uw)/uu;
+    if(s < 0)return -1;
+    tuple3<float> d = make_tuple3(w.x + s*u.x - t*v.x,w.y + s*u.y - t*v.y,w.z + s*u.z - t*v.z);
+    return (d.x*d.x + d.y*d.y + d.z*d.z <= radius*radius) ? s : -1;
+  }
+  //slab test, max_distance < 0 means unlimited
+  static bool ray_hits_box(const tuple3<float>& origin, const tuple3<float>& direction, const tuple3<float>& low, const tuple3<float>& high, float max_distance)
+  {
+    float t_enter = 0;
+    float t_exit = (max_distance < 0) ? 1e30f : max_distance;
+    const float o[3] = {origin.x,origin.y,origin.z};
+    const float d[3] = {direction.x,direction.y,direction.z};
+    const float lo[3] = {low.x,low.y,low.z};
+    const float hi[3] = {high.x,high.y,high.z};
+    for(int c1=0;c1<3;c1++)
     {
-      float theta1 = 2*PI*float(c1)/num_sides;
-      float theta2 = 2*PI*float(c1+1)/num_sides;
-      float y_seg1 = PI*float(c2)/num_vert_segments;
-      float y_seg2 = PI*float(c2+1)/num_vert_segments;
-      float height1 = radius.y*cos(y_seg1);
-      float height2 = radius.y*cos(y_seg2);
-      tuple3<float> p1 = make_tuple3<float>(radius.x*sin(y_seg1)*cos(theta1),height1,radius.z*sin(y_seg1)*sin(theta1));
-      tuple3<float> p2 = make_tuple3<float>(radius.x*sin(y_seg2)*cos(theta1),height2,radius.z*sin(y_seg2)*sin(theta1));
-      tuple3<float> p3 = make_tuple3<float>(radius.x*sin(y_seg1)*cos(theta2),height1,radius.z*sin(y_seg1)*sin(theta2));
-      tuple3<float> p4 = make_tuple3<float>(radius.x*sin(y_seg2)*cos(theta2),height2,radius.z*sin(y_seg2)*sin(theta2));
-      if(use_rand_color)color = random_color();
-      std::vector<triangle_type> tmp = triangles_from_rectangle(p1,p2,p3,p4,color);
-      for(int c3=0;c3<tmp.size();c3++)
+      if(absolute(d[c1]) < 1e-12f)
       {
-        obj->triangles.push_back(tmp[c3]);
+        if(o[c1] < lo[c1] || o[c1] > hi[c1])return false;
+        continue;
       }
+      float t1 = (lo[c1]-o[c1])/d[c1];
+      float t2 = (hi[c1]-o[c1])/d[c1];
+      if(t1 > t2)std::swap(t1,t2);
+      t_enter = std::max(t_enter,t1);
+      t_exit = std::min(t_exit,t2);
+      if(t_enter > t_exit)return false;
     }
+    return true;
   }
+  std::vector<node> nodes;
+  std::vector<item> items;
   
-  return obj;
-}
-
-object3d* combine_objects(std::vector<object3d*>& objects)
-{
-  object3d* obj = new object3d;
-  while(objects.size() > 0)
+  private:
+  //refreshes an item's rotation-proof sphere, true if it changed
+  bool update_item(item& it)
   {
-    while((objects.back())->triangles.size() > 0)
+    it.obj->update_bounds();
+    tuple3<float> c = it.obj->bounds_center;
+    float radius = sqrt(c.x*c.x + c.y*c.y + c.z*c.z) + it.obj->bounds_radius;
+    tuple3<float> position = it.obj->position;
+    if(it.leaf != -1 && radius == it.radius && position.x == it.position.x && position.y == it.position.y && position.z == it.position.z)return false;
+    it.radius = radius;
+    it.position = position;
+    return true;
+  }
+  int build_node(int first, int count, int parent)
+  {
+    int index = nodes.size();
+    nodes.push_back(node());
+    nodes[index].parent = parent;
+    nodes[index].children[0] = nodes[index].children[1] = -1;
+    nodes[index].first_item = first;
+    nodes[index].item_count = count;
+    if(count <= LEAF_SIZE)
     {
-      triangle_type tmp_tri = (objects.back())->triangles.back();
-      for(int c2=0;c2<3;c2++)
+      for(int c1=first;c1<first+count;c1++)
+      {
+        items[c1].leaf = index;
+      }
+      update_node_bounds(index);
+      return index;
+    }
+    //median split along the axis the item centers are most spread out on
+    tuple3<float> low = items[first].position;
+    tuple3<float> high = low;
+    for(int c1=first+1;c1<first+count;c1++)
+    {
+      const tuple3<float>& p = items[c1].position;
+      low = make_tuple3(std::min(low.x,p.x),std::min(low.y,p.y),std::min(low.z,p.z));
+      high = make_tuple3(std::max(high.x,p.x),std::max(high.y,p.y),std::max(high.z,p.z));
+    }
+    item_center_less less;
+    less.axis = 0;
+    if(high.y-low.y > high.x-low.x)less.axis = 1;
+    if(high.z-low.z > std::max(high.x-low.x,high.y-low.y))less.axis = 2;
+    int middle = first+count/2;
+    std::nth_element(items.begin()+first,items.begin()+middle,items.begin()+first+count,less);
+    int left = build_node(first,middle-first,index);
+    int right = build_node(middle,first+count-middle,index);
+    nodes[index].children[0] = left;
+    nodes[index].children[1] = right;
+    update_node_bounds(index);
+    return index;
+  }
+  void update_node_bounds(int index)
+  {
+    node& n = nodes[index];
+    if(n.children[0] != -1)
+    {
+      const node& a = nodes[n.children[0]];
+      const node& b = nodes[n.children[1]];
+      n.low = make_tuple3(std::min(a.low.x,b.low.x),std::min(a.low.y,b.low.y),std::min(a.low.z,b.low.z));
+      n.high = make_tuple3(std::max(a.high.x,b.high.x),std::max(a.high.y,b.high.y),std::max(a.high.z,b.high.z));
+      return;
+    }
+    for(int c1=n.first_item;c1<n.first_item+n.item_count;c1++)
+    {
+      const item& it = items[c1];
+      tuple3<float> low = make_tuple3(it.position.x-it.radius,it.position.y-it.radius,it.position.z-it.radius);
+      tuple3<float> high = make_tuple3(it.position.x+it.radius,it.position.y+it.radius,it.position.z+it.radius);
+      if(c1 == n.first_item)
       {
-        tmp_tri.verts[c2].pos = rotate_point(tmp_tri.verts[c2].pos,(objects.back())->rotation);
-        tmp_tri.verts[c2].pos = tmp_tri.verts[c2].pos + (objects.back())->position;
+        n.low = low;
+        n.high = high;
       }
-      obj->triangles.push_back(tmp_tri);
-      (objects.back())->triangles.pop_back();
+      n.low = make_tuple3(std::min(n.low.x,low.x),std::min(n.low.y,low.y),std::min(n.low.z,low.z));
+      n.high = make_tuple3(std::max(n.high.x,high.x),std::max(n.high.y,high.y),std::max(n.high.z,high.z));
     }
-    delete objects.back();
-    objects.pop_back();
   }
-  return obj;
-}
-
-object3d* generate_spiral(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
-{
-  std::vector<object3d*> objects;
-  float deltay = float(height)/vert_segments;
-  for(float y=0;y<height;y += deltay)
+  //leaves of a node are a contiguous range of items, since build_node partitions in place
+  void add_subtree(const node& n, std::vector<int>& visible)
   {
-    int circpoint = y/deltay;
-    //for(int circpoint = 0;circpoint < ngon_segments;circpoint++)
+    const node* leftmost = &n;
+    while(leftmost->children[0] != -1)leftmost = &nodes[leftmost->children[0]];
+    const node* rightmost = &n;
+    while(rightmost->children[0] != -1)rightmost = &nodes[rightmost->children[1]];
+    for(int c1=leftmost->first_item;c1<rightmost->first_item+rightmost->item_count;c1++)
     {
-      tuple3<float> deltapoint = make_tuple3<float>(radius*(cos(2*PI*float(circpoint+1)/ngon_segments)-cos(2*PI*float(circpoint)/ngon_segments)),deltay,radius*(sin(2*PI*float(circpoint+1)/ngon_segments)-sin(2*PI*float(circpoint)/ngon_segments)));
-      object3d* tmp = generate_ngon_tube(3,thickness,deltapoint,color);
-      tmp->position = make_tuple3<float>(radius*cos(2*PI*float(circpoint)/ngon_segments),y,radius*sin(2*PI*float(circpoint)/ngon_segments));
-      objects.push_back(tmp);
+      if(items[c1].obj != NULL)visible.push_back(items[c1].object_index);
     }
   }
-  return combine_objects(objects);
-}
-
-object3d* generate_dotted_spiral(unsigned int ngon_segments, unsigned int vert_segments, unsigned int height, float radius, float thickness, tuple4<float> color)
-{
-  std::vector<object3d*> objects;
-  float deltay = float(height)/vert_segments;
-  for(float y=0;y<height;y += deltay)
+  void attach(object3d* obj, int index)
   {
-    int circpoint = y/deltay;
-    object3d* tmp = generate_sphereoid(3,2,make_tuple3<float>(thickness,thickness,thickness),color);
-    tmp->position = make_tuple3<float>(radius*cos(2*PI*float(circpoint)/ngon_segments),y,radius*sin(2*PI*float(circpoint)/ngon_segments));
-    objects.push_back(tmp);
+    obj->bvh_item = index;
+    obj->bvh_moved = &moved;
+    obj->bvh_refit_pending = false;
   }
-  return combine_objects(objects);
-}
+  void detach(object3d* obj)
+  {
+    obj->bvh_item = -1;
+    obj->bvh_moved = NULL;
+    obj->bvh_refit_pending = false;
+  }
+  void release_items()
+  {
+    for(size_t c1=0;c1<items.size();c1++)
+    {
+      if(items[c1].obj != NULL)detach(items[c1].obj);
+    }
+    moved.clear();
+  }
+  int tree_items; //items [0,tree_items) are in the tree, the rest were inserted since
+  int removed_items; //holes left in the tree by remove
+  bool needs_build;
+  std::vector<object3d*> moved;
+  std::vector<int> stack;
+};
 
 class opengl_panel : public Fl_Gl_Window
 {
@@ -722,17 +4773,33 @@ class opengl_panel : public Fl_Gl_Window
   tuple3<float> camera_rot;
   std::vector<object3d*>* objects;
   char keybuffer[256];
+  //how many objects the last draw() sent to the GPU, and how many it skipped for being outside the view frustum
+  int objects_drawn;
+  int objects_culled;
+  scene_bvh* bvh; //over objects, and shared along with them
+  std::vector<int> visible_objects;
+  std::vector<std::pair<size_t,size_t> > instance_runs; //[first,end) ranges of instances in view, see draw_instances
+  object3d* picked_object; //the last object clicked on, NULL if the click missed everything
   opengl_panel(int x, int y, int w, int h, const char* title=0) : Fl_Gl_Window(x,y,w,h,title)
   {
     objects = new std::vector<object3d*>;
+    bvh = new scene_bvh;
     this->gl_mode = GL_TRIANGLES;
     camera_pos = make_tuple3<float>(0,0,0);
     camera_rot = make_tuple3<float>(0,0,0);
     MOVE_DELTA = .2;
     ROTATE_DELTA = .3;
+    objects_drawn = 0;
+    objects_culled = 0;
+    picked_object = NULL;
   }
   ~opengl_panel()
   {
+    if(bvh != NULL)
+    {
+      delete bvh;
+      bvh = NULL;
+    }
     if(objects != NULL)
     {
       while(objects->size() > 0)
@@ -744,15 +4811,43 @@ class opengl_panel : public Fl_Gl_Window
       objects = NULL;
     }
   }
+  //adding and removing objects through these keeps the hierarchy from being rebuilt, other changes to objects need
+  //bvh->objects_changed()
+  void add_object(object3d* obj)
+  {
+    objects->push_back(obj);
+    bvh->insert(obj,objects->size()-1);
+  }
+  object3d* remove_last_object()
+  {
+    object3d* obj = objects->back();
+    objects->pop_back();
+    bvh->remove(obj);
+    return obj;
+  }
+  //same as glRotatef(camera_rot.x,1,0,0) glRotatef(camera_rot.y,0,1,0) glRotatef(camera_rot.z,0,0,1) glTranslatef(-camera_pos)
+  mat4 view_matrix()
+  {
+    return mat4::axis_rotation(camera_rot.x,make_tuple3<float>(1,0,0))*
+           mat4::axis_rotation(camera_rot.y,make_tuple3<float>(0,1,0))*
+           mat4::axis_rotation(camera_rot.z,make_tuple3<float>(0,0,1))*
+           mat4::translation(make_tuple3(-camera_pos.x,-camera_pos.y,-camera_pos.z));
+  }
   void draw()
   {
     if(objects == NULL)return;
+    load_gl_extensions();
+    //the matrices are built here rather than with glFrustum/glRotatef, so culling uses exactly what the GPU does
+    mat4 projection = mat4::frustum(-1,1,-1,1,1,10000);
+    mat4 view = view_matrix();
+    view_frustum frustum(projection*view);
+    objects_drawn = 0;
+    objects_culled = 0;
     glViewport(0,0,this->w(),this->h());
 		glMatrixMode(GL_PROJECTION);
-		glLoadIdentity();
-		glFrustum(-1,1,-1,1,1,10000);
+		glLoadMatrixf(projection.data());
 		glMatrixMode(GL_MODELVIEW);
-		glLoadIdentity();
+		glLoadMatrixf(view.data());
 		glClearColor(0,0,0,1);
 		glShadeModel(GL_SMOOTH);
 		glClearDepth(1.0f);
@@ -761,41 +4856,284 @@ class opengl_panel : public Fl_Gl_Window
 		glEnable(GL_ALPHA_TEST);
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+		glTexEnvf(GL_TEXTURE_ENV,GL_TEXTURE_ENV_MODE,GL_REPLACE);
+		//glTexEnvf(GL_TEXTURE_ENV,GL_COMBINE_RGB,GL_REPLACE);
+		//glTexEnvf(GL_TEXTURE_ENV,GL_COMBINE_ALPHA,GL_REPLACE);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
-		glRotatef(camera_rot.x,1,0,0);
-		glRotatef(camera_rot.y,0,1,0);
-		glRotatef(camera_rot.z,0,0,1);
-		glTranslatef(-camera_pos.x,-camera_pos.y,-camera_pos.z);
-		
-    for(int c1=0;c1<objects->size();c1++)
+    bvh->sync(*objects);
+    bvh->query_frustum(frustum,visible_objects);
+    //the hierarchy hands them back in tree order, but blending depends on the order they were added to the scene
+    std::sort(visible_objects.begin(),visible_objects.end());
+    objects_culled = objects->size()-visible_objects.size();
+    if(TEXTURE_ATLAS)
     {
-      if((*objects)[c1] == NULL)continue;
-      if(!(((*objects)[c1])->visible))continue;
-      if((*objects)[c1]->use_uvmap)
+      for(size_t c1=0;c1<objects->size();c1++)
       {
-		    (*objects)[c1]->uvmap->apply_texture();
+        if((*objects)[c1]->use_uvmap)uvmap_atlas.add((*objects)[c1]->uvmap);
       }
-      else
+      uvmap_atlas.update();
+    }
+    //objects sharing an atlas page (or a uvmap) don't bind it again
+    texture_image* bound_texture = NULL;
+    glDisable(GL_TEXTURE_2D);
+    for(size_t c1=0;c1<visible_objects.size();c1++)
+    {
+      object3d* obj = (*objects)[visible_objects[c1]];
+      if(!obj->visible)continue;
+      mat4 model = mat4::from_rotation_translation(obj->rotation,obj->position);
+      //the tree only knows a sphere that holds the object at any rotation, this one is tighter.
+      //rotation and translation don't change the radius, only where the center ends up
+      if(!frustum.sphere_visible(model.transform_point(obj->bounds_center),obj->bounds_radius))
+      {
+        objects_culled++;
+        continue;
+      }
+      objects_drawn++;
+      texture_image* texture = NULL;
+      if(obj->use_uvmap)
+      {
+        texture_image* page = TEXTURE_ATLAS ? uvmap_atlas.page_of(obj->uvmap) : NULL;
+        texture = (page != NULL) ? page : obj->uvmap;
+      }
+      if(texture != bound_texture)
+      {
+        if(texture != NULL)texture->apply_texture();
+        else glDisable(GL_TEXTURE_2D);
+        bound_texture = texture;
+      }
+      bool texture_transform = obj->use_uvmap && (TEXTURE_ATLAS || obj->compact != NULL);
+      if(texture_transform)
       {
-        glDisable(GL_TEXTURE_2D);
+        //texcoords are dequantized first, then mapped onto the uvmap's place on its page
+        glMatrixMode(GL_TEXTURE);
+        glLoadIdentity();
+        if(TEXTURE_ATLAS)uvmap_atlas.apply_texcoord_transform(obj->uvmap);
+        if(obj->compact != NULL)obj->compact->apply_texcoord_dequantization();
+        glMatrixMode(GL_MODELVIEW);
       }
-      glBegin(gl_mode);
+      glPushMatrix();
+      glMultMatrixf(model.data());
       glColor4f(1,1,1,1);
-      for(int c2=0;c2<(*objects)[c1]->triangles.size();c2++)
+      if(obj->dots != NULL)
       {
-        for(int c3=0;c3<3;c3++)
+        draw_dots(obj);
+      }
+      else if(obj->line != NULL)
+      {
+        draw_polyline(obj);
+      }
+      else if(!obj->instances.empty())
+      {
+        draw_instances(obj,model,frustum);
+      }
+      else if(gl_ext.have_vbo)
+      {
+        if(obj->compact != NULL)obj->compact->apply_position_dequantization();
+        obj->update_mesh_buffer();
+        obj->mesh.draw(gl_mode,obj->use_uvmap);
+      }
+      else
+      {
+        if(obj->compact != NULL)obj->compact->apply_position_dequantization();
+        draw_vertex_source(obj->get_vertex_source(),gl_mode,obj->use_uvmap);
+      }
+      if(texture_transform)
+      {
+        glMatrixMode(GL_TEXTURE);
+        glLoadIdentity();
+        glMatrixMode(GL_MODELVIEW);
+      }
+      glPopMatrix();
+    }
+    if(PRINT_CULLING_STATS)printf("%d objects drawn, %d culled\n",objects_drawn,objects_culled);
+  }
+  //a line strip as wide as the line would look at the distance of the object's center (lines can't get thinner
+  //towards the back the way geometry does). expects the object's transform on the modelview stack already
+  void draw_polyline(object3d* obj)
+  {
+    polyline* line = obj->line;
+    float modelview[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX,modelview);
+    const tuple3<float>& c = obj->bounds_center;
+    float distance = -(modelview[2]*c.x + modelview[6]*c.y + modelview[10]*c.z + modelview[14]);
+    //same projection scale as draw_dots uses
+    glLineWidth(std::max(1.0f,line->width*this->h()/std::max(distance,1.0f)));
+    glColor4f(line->color.w,line->color.x,line->color.y,line->color.z);
+    if(gl_ext.have_vbo)
+    {
+      obj->update_mesh_buffer();
+      obj->mesh.draw(GL_LINE_STRIP,false);
+    }
+    else
+    {
+      draw_vertex_source(obj->get_vertex_source(),GL_LINE_STRIP,false);
+    }
+    glLineWidth(1);
+  }
+  //point sprites sized by distance when the driver has point parameters, otherwise a camera facing quad per dot.
+  //expects the object's transform on the modelview stack already
+  void draw_dots(object3d* obj)
+  {
+    dot_cloud* dots = obj->dots;
+    glColor4f(dots->color.w,dots->color.x,dots->color.y,dots->color.z);
+    if(gl_ext.have_point_parameters)
+    {
+      //this projection maps a sphere of radius r at distance d to r*h/d pixels across,
+      //and the {0,0,1} attenuation divides the point size by d
+      const float attenuation[3] = {0,0,1};
+      const float no_attenuation[3] = {1,0,0};
+      gl_ext.point_parameterfv(GL_POINT_DISTANCE_ATTENUATION,attenuation);
+      glPointSize(dots->radius*this->h());
+      glEnable(GL_POINT_SMOOTH);
+      if(gl_ext.have_vbo)
+      {
+        obj->update_mesh_buffer();
+        obj->mesh.draw(GL_POINTS,false);
+      }
+      else
+      {
+        draw_vertex_source(obj->get_vertex_source(),GL_POINTS,false);
+      }
+      glDisable(GL_POINT_SMOOTH);
+      glPointSize(1);
+      gl_ext.point_parameterfv(GL_POINT_DISTANCE_ATTENUATION,no_attenuation);
+      return;
+    }
+    //the first two rows of the modelview rotation are the eye's right and up directions in object space
+    float modelview[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX,modelview);
+    tuple3<float> right = make_tuple3(modelview[0]*dots->radius,modelview[4]*dots->radius,modelview[8]*dots->radius);
+    tuple3<float> up = make_tuple3(modelview[1]*dots->radius,modelview[5]*dots->radius,modelview[9]*dots->radius);
+    std::vector<float>& quads = dots->impostor_vertices;
+    quads.resize(dots->centers.size()*12);
+    for(size_t c1=0;c1<dots->centers.size();c1++)
+    {
+      const tuple3<float>& c = dots->centers[c1];
+      float* q = &quads[c1*12];
+      q[0] = c.x-right.x-up.x; q[1] = c.y-right.y-up.y; q[2] = c.z-right.z-up.z;
+      q[3] = c.x+right.x-up.x; q[4] = c.y+right.y-up.y; q[5] = c.z+right.z-up.z;
+      q[6] = c.x+right.x+up.x; q[7] = c.y+right.y+up.y; q[8] = c.z+right.z+up.z;
+      q[9] = c.x-right.x+up.x; q[10] = c.y-right.y+up.y; q[11] = c.z-right.z+up.z;
+    }
+    if(quads.empty())return;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3,GL_FLOAT,0,&quads[0]);
+    glDrawArrays(GL_QUADS,0,quads.size()/3);
+    glDisableClientState(GL_VERTEX_ARRAY);
+  }
+  //draws the chunks of instances that are in view, each run of consecutive ones with one instanced call when the driver
+  //can, otherwise binds the mesh once and only changes the modelview matrix between instances. expects model on the
+  //modelview stack already
+  void draw_instances(object3d* obj, const mat4& model, const view_frustum& frustum)
+  {
+    obj->update_instance_chunks();
+    instance_runs.clear();
+    for(size_t c1=0;c1<obj->instance_chunks.size();c1++)
+    {
+      const object3d::instance_chunk& chunk = obj->instance_chunks[c1];
+      if(!frustum.sphere_visible(model.transform_point(chunk.center),chunk.radius))continue;
+      if(!instance_runs.empty() && instance_runs.back().second == chunk.first)instance_runs.back().second += chunk.count;
+      else instance_runs.push_back(std::make_pair(chunk.first,chunk.first+chunk.count));
+    }
+    if(instance_runs.empty())return;
+    mat4 spin = mat4::from_mat3(mat3::from_rotation(obj->instance_spin),make_tuple3<float>(0,0,0));
+    mat4 dequantization = (obj->compact != NULL) ? obj->compact->position_dequantization() : mat4::identity();
+    if(gl_ext.have_instancing)
+    {
+      obj->update_mesh_buffer();
+      if(obj->instance_buffer_id == 0)
+      {
+        gl_ext.gen_buffers(1,&obj->instance_buffer_id);
+        obj->instance_buffer_dirty = true;
+      }
+      if(obj->instance_buffer_dirty)
+      {
+        gl_ext.bind_buffer(GL_ARRAY_BUFFER,obj->instance_buffer_id);
+        gl_ext.buffer_data(GL_ARRAY_BUFFER,sizeof(float)*obj->instance_data.size(),&obj->instance_data[0],GL_STATIC_DRAW);
+        obj->instance_buffer_dirty = false;
+      }
+      gl_ext.use_program(gl_ext.instancing_program);
+      gl_ext.uniform1i(gl_ext.instancing_use_uvmap,obj->use_uvmap);
+      gl_ext.uniform_matrix4fv(gl_ext.instancing_spin,1,GL_FALSE,spin.data());
+      gl_ext.uniform_matrix4fv(gl_ext.instancing_dequantization,1,GL_FALSE,dequantization.data());
+      obj->mesh.bind(obj->use_uvmap);
+      for(int c1=0;c1<4;c1++)
+      {
+        gl_ext.enable_vertex_attrib_array(INSTANCE_ATTRIBUTE_ROW0+c1);
+        gl_ext.vertex_attrib_divisor(INSTANCE_ATTRIBUTE_ROW0+c1,1);
+      }
+      //without base instances, each run points the per-instance attributes at its own part of the buffer
+      gl_ext.bind_buffer(GL_ARRAY_BUFFER,obj->instance_buffer_id);
+      for(size_t c1=0;c1<instance_runs.size();c1++)
+      {
+        size_t offset = sizeof(float)*16*instance_runs[c1].first;
+        for(int c2=0;c2<4;c2++)
+        {
+          gl_ext.vertex_attrib_pointer(INSTANCE_ATTRIBUTE_ROW0+c2,4,GL_FLOAT,GL_FALSE,16*sizeof(float),(const GLvoid*)(offset+c2*4*sizeof(float)));
+        }
+        obj->mesh.draw_bound_instanced(gl_mode,instance_runs[c1].second-instance_runs[c1].first);
+      }
+      obj->mesh.unbind();
+      gl_ext.use_program(0);
+      for(int c1=0;c1<4;c1++)
+      {
+        gl_ext.vertex_attrib_divisor(INSTANCE_ATTRIBUTE_ROW0+c1,0);
+        gl_ext.disable_vertex_attrib_array(INSTANCE_ATTRIBUTE_ROW0+c1);
+      }
+      return;
+    }
+    if(gl_ext.have_vbo)
+    {
+      obj->update_mesh_buffer();
+      obj->mesh.bind(obj->use_uvmap);
+    }
+    vertex_source source = obj->get_vertex_source();
+    for(size_t c1=0;c1<instance_runs.size();c1++)
+    {
+      for(size_t c2=instance_runs[c1].first;c2<instance_runs[c1].second;c2++)
+      {
+        const float* row = &obj->instance_data[c2*16];
+        mat4 instance = mat4::identity();
+        for(int c3=0;c3<12;c3++)
         {
-          vertex_type vert = (*objects)[c1]->triangles[c2].verts[c3];
-          vert.pos = rotate_point(vert.pos,(*objects)[c1]->rotation);
-          vert.pos = vert.pos + (*objects)[c1]->position;
-          if(!(*objects)[c1]->use_uvmap)glColor4f(vert.color.w,vert.color.x,vert.color.y,vert.color.z);
-          else glTexCoord2f(vert.texcoords.x,vert.texcoords.y);
-          glVertex3f(vert.pos.x,vert.pos.y,vert.pos.z);
+          instance.m[(c3%4)*4+c3/4] = row[c3];
         }
+        //the spin goes between the instance's own rotation and its translation
+        tuple3<float> position = make_tuple3(instance.m[12],instance.m[13],instance.m[14]);
+        instance.m[12] = instance.m[13] = instance.m[14] = 0;
+        instance = mat4::translation(position)*spin*instance*dequantization;
+        bool override_color = (row[15] > 0) && !obj->use_uvmap;
+        if(override_color)glColor4f(row[12],row[13],row[14],row[15]);
+        glPushMatrix();
+        glMultMatrixf(instance.data());
+        if(gl_ext.have_vbo)
+        {
+          //the mesh stays bound, so only its color array is switched off around the draw, and back on if bind set one
+          if(override_color)glDisableClientState(GL_COLOR_ARRAY);
+          obj->mesh.draw_bound(gl_mode);
+          if(override_color && obj->mesh.layout.color_type != 0)glEnableClientState(GL_COLOR_ARRAY);
+        }
+        else draw_vertex_source(source,gl_mode,obj->use_uvmap,!override_color);
+        glPopMatrix();
       }
-      glEnd();
     }
+    if(gl_ext.have_vbo)obj->mesh.unbind();
+  }
+  //the object under window coordinates (x,y), by casting a ray from the camera through that pixel
+  object3d* pick(int x, int y)
+  {
+    float ndc_x = 2.0f*x/this->w()-1;
+    float ndc_y = 1-2.0f*y/this->h();
+    //the frustum spans -1..1 at distance 1, and the inverse of the view rotation is its transpose
+    mat4 view = view_matrix();
+    tuple3<float> eye_direction = make_tuple3(ndc_x,ndc_y,-1.0f);
+    tuple3<float> direction = make_tuple3(view.m[0]*eye_direction.x + view.m[1]*eye_direction.y + view.m[2]*eye_direction.z,
+                                          view.m[4]*eye_direction.x + view.m[5]*eye_direction.y + view.m[6]*eye_direction.z,
+                                          view.m[8]*eye_direction.x + view.m[9]*eye_direction.y + view.m[10]*eye_direction.z);
+    float distance;
+    bvh->sync(*objects);
+    return bvh->pick(camera_pos,direction,distance);
   }
   int handle(int event)
   {
@@ -803,13 +5141,84 @@ class opengl_panel : public Fl_Gl_Window
     {
       keybuffer[c1] = Fl::event_key(c1);
     }
+    if(event == FL_PUSH && objects != NULL)
+    {
+      picked_object = pick(Fl::event_x(),Fl::event_y());
+      if(PRINT_PICKED_OBJECTS && picked_object != NULL)printf("picked object %d\n",int(std::find(objects->begin(),objects->end(),picked_object)-objects->begin()));
+    }
     return Fl_Gl_Window::handle(event);
   }
 };
 
+//fills slot c1 of each array with background object c1's cluster and prism placement (which prototype, and where)
+struct background_scatter_task : public parallel_task
+{
+  int cluster_prototype_count;
+  int* cluster_choices;
+  instance_type* cluster_instances;
+  int* prism_choices;
+  instance_type* prism_instances;
+  uint64_t stream_base;
+  void run(size_t begin, size_t end)
+  {
+    random_stream_scope scope;
+    for(size_t c1=begin;c1<end;c1++)
+    {
+      select_random_stream(stream_base+c1);
+      //random orientations keep the repeated clusters from looking identical
+      cluster_choices[c1] = std::min(int(rand_float(0,cluster_prototype_count)),cluster_prototype_count-1);
+      cluster_instances[c1] = make_instance(make_tuple3(rand_float(-1000,1000),rand_float(-1000,1000),rand_float(-1000,1000)),
+                                            make_tuple3(rand_float(0,2*PI),rand_float(0,2*PI),rand_float(0,2*PI)),
+                                            make_tuple3<float>(1,1,1),make_tuple4<float>(0,0,0,0));
+      prism_choices[c1] = std::min(int(rand_float(0,6)),5);
+      float radius = rand_float(10,100);
+      float length = rand_float(10,100);
+      //a color of its own for each prism, since they all share one of six meshes
+      prism_instances[c1] = make_instance(make_tuple3(rand_float(-2000,2000),rand_float(-2000,2000),rand_float(-2000,2000)),
+                                          make_tuple3<float>(0,0,0),make_tuple3(radius,length,radius),random_color());
+    }
+  }
+};
+
+//welds and compacts objects [begin,end), each one only touches its own geometry
+struct prepare_geometry_task : public parallel_task
+{
+  object3d** objects;
+  void run(size_t begin, size_t end)
+  {
+    for(size_t c1=begin;c1<end;c1++)
+    {
+      if(WELD_SCENE_GEOMETRY)objects[c1]->weld_geometry();
+      if(COMPACT_SCENE_GEOMETRY)objects[c1]->compact_geometry(QUANTIZE_SCENE_POSITIONS);
+    }
+  }
+};
+
 int main(int argc, char* argv[])
 {
-  MTRand mtrandom;
+  //--seed n and --texture file can go anywhere, they're taken out before the positional arguments are read. without a seed
+  //every run is different
+  uint64_t seed = uint64_t(time(NULL));
+  bool seeded = false;
+  const char* texture_path = NULL; //for whichtexture 2
+  int kept_args = 1;
+  for(int c1=1;c1<argc;c1++)
+  {
+    if(strcmp(argv[c1],"--seed") == 0 && c1+1 < argc)
+    {
+      seed = strtoul(argv[++c1],NULL,10);
+      seeded = true;
+      continue;
+    }
+    if(strcmp(argv[c1],"--texture") == 0 && c1+1 < argc)
+    {
+      texture_path = argv[++c1];
+      continue;
+    }
+    argv[kept_args++] = argv[c1];
+  }
+  argc = kept_args;
+  seed_random(seed);
   Fl_Window* window = new Fl_Window(WIDTH,HEIGHT,"Correspondence Problem Demonstration");
   opengl_panel* panel = new opengl_panel(0,0,WIDTH/2,HEIGHT);
   opengl_panel* panel2 = new opengl_panel(WIDTH/2,0,WIDTH/2,HEIGHT);
@@ -818,11 +5227,13 @@ int main(int argc, char* argv[])
   
   delete panel2->objects;
   panel2->objects = panel->objects;
+  delete panel2->bvh;
+  panel2->bvh = panel->bvh;
   
   //2 1 1 0 50 400
   if(argc == 1)
   {
-    printf("Usage: %s rotate_speed show_barberpole show_spiral show_dotted_spiral spiral_sides spiral_vsegs whichtexture background_objects\nRunning without all specified uses defaults for remainder\nDefaults are 1,1,0,0,50,400,1,0\n",argv[0]);
+    printf("Usage: %s [--seed n] [--texture file.bmp|ppm|pam] rotate_speed show_barberpole show_spiral show_dotted_spiral spiral_sides spiral_vsegs whichtexture background_objects animate_uvmap\nRunning without all specified uses defaults for remainder\nDefaults are 1,1,0,0,50,400,1,0,0\n",argv[0]);
   }
   float rotate_speed = (argc >= 2) ? .005*absolute(atoi(argv[1])) : .005;
   rotate_speed = (argc >= 2) ? ((absolute(atoi(argv[1]))==atoi(argv[1]))? rotate_speed : -rotate_speed) :rotate_speed;
@@ -833,52 +5244,133 @@ int main(int argc, char* argv[])
   int spiral_vsegs = (argc >= 7) ? atoi(argv[6]) : 400;
   int whichtexture = (argc >= 8) ? atoi(argv[7]) : 1;
   int background_objects = (argc >= 9) ? atoi(argv[8]) : 0;
-  for(int c1=0;c1<background_objects;c1++)
+  int animate_uvmap = (argc >= 10) ? atoi(argv[9]) : 0;
+  //only a seeded scene comes out the same twice, so only then is it worth keeping
+  if(CACHE_SCENE_ON_DISK && seeded)scene_disk_cache.open(SCENE_CACHE_FILE);
+  //the scene lives until the program exits, so it can come out of an arena that's never reset. its triangles are only
+  //needed until they're welded and compacted, they get an arena of their own that's released after that
+  memory_arena scene_arena;
+  memory_arena triangle_arena;
+  arena_scope scene_scope(&scene_arena,&triangle_arena);
+  if(background_objects > 0)
   {
-    object3d* tmp = new object3d;
-    tmp->position = make_tuple3(rand_float(-1000,1000),rand_float(-1000,1000),rand_float(-1000,1000));
-    for(int c2=0;c2<5;c2++)
+    //a few shared meshes placed many times, instead of a unique mesh per background object
+    int cluster_prototype_count = 16;
+    std::vector<object3d*> clusters;
+    for(int c1=0;c1<cluster_prototype_count;c1++)
     {
-      triangle_type tri;
-      for(int c3=0;c3<3;c3++)
+      object3d* tmp = new object3d;
+      float coordinates[5*3*3];
+      thread_random().fill_uniform(coordinates,5*3*3,-50,50);
+      for(int c2=0;c2<5;c2++)
       {
-        tri.verts[c3].pos = make_tuple3(rand_float(-50,50),rand_float(-50,50),rand_float(-50,50));
-        tri.verts[c3].color = random_color();
+        triangle_type tri;
+        for(int c3=0;c3<3;c3++)
+        {
+          const float* p = &coordinates[(c2*3+c3)*3];
+          tri.verts[c3].pos = make_tuple3(p[0],p[1],p[2]);
+          tri.verts[c3].color = random_color();
+          tri.verts[c3].texcoords = make_tuple2<float>(0,0);
+        }
+        tmp->triangles.push_back(tri);
       }
-      tmp->triangles.push_back(tri);
+      clusters.push_back(tmp);
+    }
+    //unit prisms, scaled per instance to the radius and length
+    std::vector<object3d*> prisms;
+    for(int c1=0;c1<6;c1++)
+    {
+      prisms.push_back(generate_ngon_prism(c1+3,1,1));
+    }
+    //placements are generated in parallel, then handed to their prototypes in order
+    std::vector<int> cluster_choices(background_objects);
+    std::vector<instance_type> cluster_instances(background_objects);
+    std::vector<int> prism_choices(background_objects);
+    std::vector<instance_type> prism_instances(background_objects);
+    background_scatter_task scatter;
+    scatter.cluster_prototype_count = cluster_prototype_count;
+    scatter.cluster_choices = &cluster_choices[0];
+    scatter.cluster_instances = &cluster_instances[0];
+    scatter.prism_choices = &prism_choices[0];
+    scatter.prism_instances = &prism_instances[0];
+    scatter.stream_base = thread_random().next_u64();
+    parallel_for(background_objects,256,scatter);
+    for(int c1=0;c1<background_objects;c1++)
+    {
+      clusters[cluster_choices[c1]]->instances.push_back(cluster_instances[c1]);
+      prisms[prism_choices[c1]]->instances.push_back(prism_instances[c1]);
+    }
+    //a prototype nothing picked would be drawn as a plain mesh at the origin, so only the used ones join the scene
+    std::vector<object3d*> prototypes(clusters);
+    prototypes.insert(prototypes.end(),prisms.begin(),prisms.end());
+    for(size_t c1=0;c1<prototypes.size();c1++)
+    {
+      if(prototypes[c1]->instances.empty())delete prototypes[c1];
+      else panel->objects->push_back(prototypes[c1]);
     }
-    panel->objects->push_back(tmp);
-    tmp = generate_ngon_prism(mtrandom.randInt(5)+3,rand_float(10,100),rand_float(10,100));
-    tmp->position = make_tuple3(rand_float(-2000,2000),rand_float(-2000,2000),rand_float(-2000,2000));
-    panel->objects->push_back(tmp);
   }
   
   //good pairs for (spiral_sides,spiral_vsegs) include {(3,40), (50,40), (50,400)}
   if(show_spiral)panel->objects->push_back(generate_spiral(spiral_sides,spiral_vsegs,400,50,1,make_tuple4<float>(0,1,1,1)));
   if(show_dotted_spiral)panel->objects->push_back(generate_dotted_spiral(spiral_sides,spiral_vsegs,400,50,2,make_tuple4<float>(1,0,0,1)));
   int numsides = 16;
+  object3d* barberpole = NULL;
   if(show_barberpole)
   {
-    panel->objects->push_back(generate_ngon_prism_uv(numsides,10,make_tuple3<float>(0,400,0)));
-    switch(whichtexture)
+    barberpole = generate_ngon_prism_uv(numsides,10,make_tuple3<float>(0,400,0));
+    panel->objects->push_back(barberpole);
+    if(animate_uvmap)barberpole->uvmap->enable_streaming();
+    texture_image* uvmap = barberpole->uvmap;
+    size_t texel_bytes = size_t(uvmap->texture_width)*uvmap->texture_height*4;
+    std::vector<unsigned char> texels;
+    mesh_key texels_key = seeded_key(mesh_key("uvmap") << whichtexture << uvmap->texture_width << uvmap->texture_height);
+    //an image is loaded as it is in the file now, the cache is only for the drawn ones
+    bool cache_texels = (whichtexture != 2);
+    if(cache_texels && scene_disk_cache.lookup(texels_key,texels) && texels.size() == texel_bytes)
     {
-      case 0:
-      panel->objects->back()->draw_uvmap_outline();
-      break;
-      case 1:
-      panel->objects->back()->draw_uvmap_barberpole();
-      break;
-      case 2:
-      panel->objects->back()->uvmap->texture_from_gimp(gimp_image);
-      break;
-      default:
-      break;
+      memcpy(uvmap->data,&texels[0],texel_bytes);
+      uvmap->mark_all_dirty();
+    }
+    else
+    {
+      switch(whichtexture)
+      {
+        case 0:
+        panel->objects->back()->draw_uvmap_outline();
+        break;
+        case 1:
+        panel->objects->back()->draw_uvmap_barberpole();
+        break;
+        case 2:
+#if EMBED_GIMP_TEXTURE
+        if(texture_path == NULL)
+        {
+          uvmap->texture_from_gimp(gimp_image);
+          break;
+        }
+#endif
+        if(texture_path == NULL)texture_path = TEXTURE_FILE;
+        if(!uvmap->texture_from_file(texture_path))
+        {
+          printf("couldn't load %s, drawing the barberpole texture instead\n",texture_path);
+          panel->objects->back()->draw_uvmap_barberpole();
+        }
+        break;
+        default:
+        break;
+      }
+      if(cache_texels)
+      {
+        texels.assign(uvmap->data,uvmap->data+texel_bytes);
+        scene_disk_cache.store(texels_key,texels);
+      }
     }
   }
   panel->camera_pos.y = panel2->camera_pos.y = 200;
   panel->camera_pos.z = panel2->camera_pos.z = 100;
   
   object3d* cylinder = NULL;
+  memory_arena frame_arena(1<<16); //the cylinder is regenerated every frame, reusing the same memory each time
 #define SHOW_CYLINDER 0
   object3d* sphere = generate_sphereoid(10,10,make_tuple3<float>(10,10,10),make_tuple4<float>(0,1,1,0));
   panel->objects->push_back(sphere);
@@ -896,10 +5388,39 @@ int main(int argc, char* argv[])
   object3d* yzplane = generate_ngon_prism(4,100,make_tuple3<float>(.1,0,0),make_tuple4<float>(0,1,1,.25));
   //panel->objects->push_back(yzplane);
   
+  scene_disk_cache.save(SCENE_CACHE_LIMIT);
+  
+  prepare_geometry_task prepare;
+  prepare.objects = panel->objects->empty() ? NULL : &(*panel->objects)[0];
+  parallel_for(panel->objects->size(),1,prepare);
+  //the planes that aren't shown are kept (and rotated) all the same
+  object3d* hidden_planes[2] = {xyplane,yzplane};
+  prepare.objects = hidden_planes;
+  prepare.run(0,2);
+  panel->bvh->objects_changed();
+  scene_scope.close();
+  if(PRINT_MESH_CACHE_STATS)printf("mesh cache: %lu hits, %lu misses, %lu bytes cached\n",generated_meshes.hits,generated_meshes.misses,(unsigned long)generated_meshes.bytes);
+  if(PRINT_ALLOCATION_STATS)printf("scene construction: %lu arena allocations (%lu bytes in %lu reserved), %lu triangle arena allocations (%lu bytes in %lu reserved), %lu heap allocations (%lu bytes)\n",
+                                   (unsigned long)scene_arena.allocations,(unsigned long)scene_arena.bytes_allocated,(unsigned long)scene_arena.bytes_reserved,
+                                   (unsigned long)triangle_arena.allocations,(unsigned long)triangle_arena.bytes_allocated,(unsigned long)triangle_arena.bytes_reserved,
+                                   (unsigned long)heap_allocations,(unsigned long)heap_bytes);
+  //every triangle_list has been given back once welding or compacting swapped them all out, anything still holding
+  //triangles (with both turned off) keeps the arena
+  if(triangle_arena.deallocations == triangle_arena.allocations)triangle_arena.release();
+  
   int counter = 0;
+  int uvmap_phase = 0;
   while(Fl::wait() != 0)
   {
+    if(animate_uvmap && barberpole != NULL)
+    {
+      //regenerated every frame, the streaming texture sends it to the GPU without stalling
+      uvmap_phase = (uvmap_phase+1) % barberpole->uvmap->texture_width;
+      if(whichtexture == 0)barberpole->draw_uvmap_outline();
+      if(whichtexture == 1)barberpole->draw_uvmap_barberpole(uvmap_phase);
+    }
     sphere->position = panel->camera_pos;
+    sphere->moved();
     sphere->rotation.x = panel->camera_rot.y*PI/180;
     sphere->rotation.y = 0;
     sphere->rotation.z = -panel->camera_rot.x*PI/180;
@@ -907,14 +5428,12 @@ int main(int argc, char* argv[])
     xyplane->rotation = xzplane->rotation = yzplane->rotation = make_tuple3<float>(0,0,0);
     if(SHOW_CYLINDER)
     {
-      if(cylinder != NULL)
-      {
-        panel->objects->pop_back();
-        delete cylinder;
-      }
-    cylinder = generate_ngon_prism(3,5,sphere->position,make_tuple4<float>(.75,.75,.75,1));
-    panel->objects->push_back(cylinder);
-  }
+      if(cylinder != NULL)delete panel->remove_last_object();
+      frame_arena.reset();
+      arena_scope frame_scope(&frame_arena);
+      cylinder = generate_ngon_prism(3,5,sphere->position,make_tuple4<float>(.75,.75,.75,1));
+      panel->add_object(cylinder);
+    }
     counter = ++counter % 500;
     switch(counter%2)
     {
@@ -938,7 +5457,10 @@ int main(int argc, char* argv[])
     for(int c1=0;c1<panel->objects->size();c1++)
     {
       //((*panel->objects)[c1])->use_uvmap = !((*panel->objects)[c1])->use_uvmap;
-      ((*panel->objects)[c1])->rotation.x += rotate_speed;
+      object3d* obj = (*panel->objects)[c1];
+      //instanced objects stay put and spin each instance in place, like separate objects would
+      if(obj->instances.empty())obj->rotation.x += rotate_speed;
+      else obj->instance_spin.x += rotate_speed;
       //((*panel->objects)[c1])->rotation.z += ((c1%2)?0:1)*.005;
       //if((*panel->objects)[c1]->use_uvmap)(*panel->objects)[c1]->draw_uvmap_outline();
     }